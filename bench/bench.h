@@ -0,0 +1,58 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* bench.h
+ *
+ * Every system has its own NTSC_SETTINGS so each one is set up in its own
+ * file (bench_ntsc.c, bench_nes.c, bench_pv1k.c), crt_bench.c only sees
+ * them through these functions.
+ *
+ */
+
+/* size of the test image given to the RGB modulators */
+#define BENCH_W 640
+#define BENCH_H 480
+
+/* Fills img with a test pattern
+ *   format - CRT_PIX_FORMAT of the image
+ */
+extern void bench_image(unsigned char *img, int w, int h, int format);
+
+struct BENCH_SYS {
+    /* returns zeroed NTSC_SETTINGS of the system that point at a test
+     * image in the given format, free() them when done.
+     * NULL if out of memory
+     */
+    void *(*create)(int format);
+    /* sets up the settings for the n-th field of the sequence */
+    void (*field)(void *s, int n);
+    /* makes a field with the system's fast path, NULL if it has none */
+    void (*fast)(struct CRT *v, void *s);
+    /* sets the modulator's chroma decimation, NULL if it has none */
+    void (*chroma_dec)(void *s, int k);
+};
+
+/* indexed by CRT_SYSTEM_ */
+extern const struct BENCH_SYS bench_ntsc;
+extern const struct BENCH_SYS bench_nes;
+extern const struct BENCH_SYS bench_pv1k;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#undef CRT_SYSTEM
+#define CRT_SYSTEM CRT_SYSTEM_NES
+#include "crt_core.h"
+#include "crt_nes_fast.h"
+#include "bench.h"
+
+#include <stdlib.h>
+
+#define NES_W 256
+#define NES_H 240
+
+struct BENCH_NES {
+    struct NTSC_SETTINGS s; /* must be first */
+    unsigned short img[NES_W * NES_H];
+    struct NES_FAST fast;
+};
+
+/* the NES modulator takes palette indices, format is ignored */
+static void *
+create(int format)
+{
+    struct BENCH_NES *b;
+    int x, y;
+
+    (void) format;
+    b = calloc(1, sizeof(struct BENCH_NES));
+    if (b == NULL) {
+        return NULL;
+    }
+    for (y = 0; y < NES_H; y++) {
+        for (x = 0; x < NES_W; x++) {
+            /* 6-bit color with the emphasis bits changing every 30 lines */
+            b->img[x + y * NES_W] = ((x / 16 + y / 15 * 16) & 0x3f)
+                                  | ((y / 30) & 7) << 6;
+        }
+    }
+    b->s.data = b->img;
+    b->s.w = NES_W;
+    b->s.h = NES_H;
+    b->s.border_color = 0x22;
+    return &b->s;
+}
+
+static void
+field(void *s, int n)
+{
+    struct NTSC_SETTINGS *ntsc = s;
+
+    ntsc->dot_crawl_offset = n % CRT_CC_VPER;
+}
+
+static void
+fast(struct CRT *v, void *s)
+{
+    struct BENCH_NES *b = s;
+
+    crt_nes_fast(v, &b->s, &b->fast);
+}
+
+const struct BENCH_SYS bench_nes = { create, field, fast, NULL };
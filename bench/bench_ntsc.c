@@ -0,0 +1,59 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#undef CRT_SYSTEM
+#define CRT_SYSTEM CRT_SYSTEM_NTSC
+#include "crt_core.h"
+#include "bench.h"
+
+#include <stdlib.h>
+
+struct BENCH_NTSC {
+    struct NTSC_SETTINGS s; /* must be first */
+    unsigned char img[BENCH_W * BENCH_H * 4];
+};
+
+static void *
+create(int format)
+{
+    struct BENCH_NTSC *b;
+
+    b = calloc(1, sizeof(struct BENCH_NTSC));
+    if (b == NULL) {
+        return NULL;
+    }
+    bench_image(b->img, BENCH_W, BENCH_H, format);
+    b->s.data = b->img;
+    b->s.format = format;
+    b->s.w = BENCH_W;
+    b->s.h = BENCH_H;
+    b->s.as_color = 1;
+    return &b->s;
+}
+
+static void
+field(void *s, int n)
+{
+    struct NTSC_SETTINGS *ntsc = s;
+
+    /* interlaced */
+    ntsc->field = n & 1;
+    ntsc->frame = (n >> 1) & 1;
+}
+
+static void
+chroma_dec(void *s, int k)
+{
+    struct NTSC_SETTINGS *ntsc = s;
+
+    ntsc->chroma_dec = k;
+}
+
+const struct BENCH_SYS bench_ntsc = { create, field, NULL, chroma_dec };
@@ -0,0 +1,51 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#undef CRT_SYSTEM
+#define CRT_SYSTEM CRT_SYSTEM_PV1K
+#include "crt_core.h"
+#include "bench.h"
+
+#include <stdlib.h>
+
+struct BENCH_PV1K {
+    struct NTSC_SETTINGS s; /* must be first */
+    unsigned char img[BENCH_W * BENCH_H * 4];
+};
+
+static void *
+create(int format)
+{
+    struct BENCH_PV1K *b;
+
+    b = calloc(1, sizeof(struct BENCH_PV1K));
+    if (b == NULL) {
+        return NULL;
+    }
+    bench_image(b->img, BENCH_W, BENCH_H, format);
+    b->s.data = b->img;
+    b->s.format = format;
+    b->s.w = BENCH_W;
+    b->s.h = BENCH_H;
+    b->s.as_color = 1;
+    return &b->s;
+}
+
+static void
+field(void *s, int n)
+{
+    struct NTSC_SETTINGS *ntsc = s;
+
+    ntsc->field = n & 1;
+    ntsc->frame = (n >> 1) & 1;
+    ntsc->dot_crawl_offset = n % CRT_CC_VPER;
+}
+
+const struct BENCH_SYS bench_pv1k = { create, field, NULL, NULL };
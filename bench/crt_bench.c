@@ -0,0 +1,451 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "crt_core.h"
+#include "crt_pool.h"
+#include "bench.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/* crt_bench.c
+ *
+ * Measures crt_modulate() and crt_demodulate() separately for every
+ * combination of the settings given on the command line and prints one
+ * CSV row per measurement so the results can be compared between builds.
+ *
+ */
+
+#define MAX_LIST 16
+
+struct LIST {
+    int n;
+    int v[MAX_LIST];
+};
+
+static const struct BENCH_SYS *bench_sys[CRT_NUM_SYSTEMS] = {
+    &bench_ntsc, &bench_nes, &bench_pv1k
+};
+
+static const char *fmt_name[] = {
+    "RGB", "BGR", "ARGB", "RGBA", "ABGR", "BGRA"
+};
+
+static struct CRT crt;
+
+static double
+now_ns(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER t, f;
+
+    QueryPerformanceCounter(&t);
+    QueryPerformanceFrequency(&f);
+    return (double) t.QuadPart * 1e9 / (double) f.QuadPart;
+#else
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double) t.tv_sec * 1e9 + (double) t.tv_nsec;
+#endif
+}
+
+extern void
+bench_image(unsigned char *img, int w, int h, int format)
+{
+    int x, y, r, g, b;
+    int bpp = crt_bpp4fmt(format);
+
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < w; x++) {
+            /* gradients with a checkerboard so there is detail to filter */
+            r = x * 255 / w;
+            g = y * 255 / h;
+            b = (((x >> 3) ^ (y >> 3)) & 1) ? 255 - r : g;
+            switch (format) {
+                case CRT_PIX_FORMAT_RGB:
+                case CRT_PIX_FORMAT_RGBA:
+                    img[0] = r; img[1] = g; img[2] = b;
+                    break;
+                case CRT_PIX_FORMAT_BGR:
+                case CRT_PIX_FORMAT_BGRA:
+                    img[0] = b; img[1] = g; img[2] = r;
+                    break;
+                case CRT_PIX_FORMAT_ARGB:
+                    img[1] = r; img[2] = g; img[3] = b;
+                    break;
+                case CRT_PIX_FORMAT_ABGR:
+                    img[1] = b; img[2] = g; img[3] = r;
+                    break;
+                default:
+                    break;
+            }
+            if (format == CRT_PIX_FORMAT_RGBA || format == CRT_PIX_FORMAT_BGRA) {
+                img[3] = 0xff;
+            } else if (bpp == 4) {
+                img[0] = 0xff;
+            }
+            img += bpp;
+        }
+    }
+}
+
+/* parses a comma separated list of numbers, each one either a single
+ * value or two separated by sep (for sizes like 640x480)
+ *
+ * returns 0 if the list is malformed
+ */
+static int
+parse_list(const char *s, struct LIST *a, struct LIST *b, int sep)
+{
+    char *end;
+
+    a->n = 0;
+    if (b) {
+        b->n = 0;
+    }
+    while (*s) {
+        if (a->n == MAX_LIST) {
+            return 0;
+        }
+        a->v[a->n++] = (int) strtol(s, &end, 10);
+        if (end == s) {
+            return 0;
+        }
+        s = end;
+        if (b) {
+            if (*s++ != sep) {
+                return 0;
+            }
+            b->v[b->n++] = (int) strtol(s, &end, 10);
+            if (end == s) {
+                return 0;
+            }
+            s = end;
+        }
+        if (*s == ',') {
+            s++;
+        } else if (*s) {
+            return 0;
+        }
+    }
+    return a->n > 0;
+}
+
+/* runs the modulator for n fields starting at field f,
+ * returns the time it took in ns
+ */
+static double
+time_mod(void *s, const struct BENCH_SYS *bs, int f, int n,
+        struct CRT_POOL *pool)
+{
+    double t;
+    int i;
+
+    t = now_ns();
+    for (i = 0; i < n; i++) {
+        bs->field(s, f + i);
+        crt_modulate_mt(&crt, s, pool);
+    }
+    return now_ns() - t;
+}
+
+static double
+time_demod(int noise, int n, struct CRT_POOL *pool)
+{
+    double t;
+    int i;
+
+    t = now_ns();
+    for (i = 0; i < n; i++) {
+        crt_demodulate_mt(&crt, noise, pool);
+    }
+    return now_ns() - t;
+}
+
+/* makes n fields with the system's fast path starting at field f */
+static double
+time_fast(void *s, const struct BENCH_SYS *bs, int f, int n)
+{
+    double t;
+    int i;
+
+    t = now_ns();
+    for (i = 0; i < n; i++) {
+        bs->field(s, f + i);
+        bs->fast(&crt, s);
+    }
+    return now_ns() - t;
+}
+
+static void
+report(const char *op, int sys, int fmt, int w, int h, int noise, int mode,
+        int quality, int cdec, int threads, int fields, double ns)
+{
+    const struct CRT_SYS *d = crt_get_sys(sys);
+    double samples = (double) d->hres * d->vres;
+
+    printf("%s,%s,%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%.0f,%.2f,%.3f\n",
+            op, d->name, fmt_name[fmt], w, h, noise,
+            mode & 1, (mode >> 1) & 1, (mode >> 2) & 1, quality, cdec,
+            threads, fields, ns, 1e9 / ns, ns / samples);
+}
+
+static void
+usage(char *p)
+{
+    printf("usage: %s [options]\n", p);
+    printf("\t-s list : systems (%d = NTSC, %d = NES, %d = PV-1000)\n",
+            CRT_SYSTEM_NTSC, CRT_SYSTEM_NES, CRT_SYSTEM_PV1K);
+    printf("\t-f list : pixel formats, CRT_PIX_FORMAT_ values 0-5\n");
+    printf("\t-z list : output sizes as WxH\n");
+    printf("\t-n list : noise levels\n");
+    printf("\t-m list : demodulator modes, sum of 1 = blend, 2 = scanlines,\n");
+    printf("\t          4 = reuse (the signal does not change between fields)\n");
+    printf("\t-q list : demodulator filters, %d = EQ, %d = FIR, %d = box (default %d)\n",
+            CRT_QUALITY_EQ, CRT_QUALITY_FIR, CRT_QUALITY_BOX, CRT_QUALITY_DEFAULT);
+    printf("\t-c list : demodulator chroma decimation, I and Q at 1 / 2^c of the rate,\n");
+    printf("\t          0-%d (default %d)\n", CRT_CHROMA_DEC_MAX, CRT_CHROMA_DEC);
+    printf("\t-d list : modulator chroma decimation, 0-%d (default 0, NTSC only)\n",
+            CRT_CHROMA_DEC_MAX);
+    printf("\t-i n    : fields timed per measurement\n");
+    printf("\t-r n    : repetitions, the fastest one is reported\n");
+    printf("\t-t n    : threads (0 = one per processor)\n");
+    printf("sample usage: %s -s 0 -f 0,5 -z 640x480,1920x1440 -n 0,24 -m 0,3\n", p);
+    printf("output is CSV, times are per field, ns_sample is per sample of the analog signal\n");
+    printf("mod rows are for the %dx%d test image (256x240 for NES),\n", BENCH_W, BENCH_H);
+    printf("only the columns up to format and chroma_dec apply to them\n");
+    printf("fast rows are modulate + demodulate with crt_nes_fast() (NES only)\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    struct LIST systems = { 3, { CRT_SYSTEM_NTSC, CRT_SYSTEM_NES, CRT_SYSTEM_PV1K } };
+    struct LIST formats = { 2, { CRT_PIX_FORMAT_RGB, CRT_PIX_FORMAT_BGRA } };
+    struct LIST ws = { 2, { 640, 1920 } };
+    struct LIST hs = { 2, { 480, 1440 } };
+    struct LIST noises = { 2, { 0, 24 } };
+    struct LIST modes = { 4, { 0, 1, 2, 3 } };
+    struct LIST qualities = { 1, { CRT_QUALITY_DEFAULT } };
+    struct LIST cdecs = { 1, { CRT_CHROMA_DEC } };
+    struct LIST mdecs = { 1, { 0 } };
+    int fields = 8, reps = 3, threads = 1;
+    struct CRT_POOL *pool = NULL;
+    unsigned char *out;
+    double t, best;
+    void *s;
+    int i, j, a, b, k, q, c, m, r, sys, fmt, ok;
+
+    for (i = 1; i < argc; i++) {
+        if (argv[i][0] != '-' || argv[i][1] == 'h' || i + 1 == argc) {
+            usage(argv[0]);
+            return 0;
+        }
+        ok = 1;
+        switch (argv[i][1]) {
+            case 's':
+                ok = parse_list(argv[++i], &systems, NULL, 0);
+                break;
+            case 'f':
+                ok = parse_list(argv[++i], &formats, NULL, 0);
+                break;
+            case 'z':
+                ok = parse_list(argv[++i], &ws, &hs, 'x');
+                break;
+            case 'n':
+                ok = parse_list(argv[++i], &noises, NULL, 0);
+                break;
+            case 'm':
+                ok = parse_list(argv[++i], &modes, NULL, 0);
+                break;
+            case 'q':
+                ok = parse_list(argv[++i], &qualities, NULL, 0);
+                break;
+            case 'c':
+                ok = parse_list(argv[++i], &cdecs, NULL, 0);
+                break;
+            case 'd':
+                ok = parse_list(argv[++i], &mdecs, NULL, 0);
+                break;
+            case 'i':
+                fields = atoi(argv[++i]);
+                break;
+            case 'r':
+                reps = atoi(argv[++i]);
+                break;
+            case 't':
+                threads = atoi(argv[++i]);
+                break;
+            default:
+                ok = 0;
+                break;
+        }
+        if (!ok) {
+            printf("bad option %s %s\n", argv[i - 1], argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    for (i = 0; i < systems.n; i++) {
+        if (crt_get_sys(systems.v[i]) == NULL) {
+            printf("unknown system %d\n", systems.v[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    for (i = 0; i < formats.n; i++) {
+        if (formats.v[i] < 0 || crt_bpp4fmt(formats.v[i]) == 0) {
+            printf("unknown pixel format %d\n", formats.v[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    for (i = 0; i < ws.n; i++) {
+        if (ws.v[i] <= 0 || hs.v[i] <= 0) {
+            printf("bad size %dx%d\n", ws.v[i], hs.v[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    for (i = 0; i < qualities.n; i++) {
+        if (qualities.v[i] < CRT_QUALITY_EQ || qualities.v[i] > CRT_QUALITY_BOX) {
+            printf("unknown quality %d\n", qualities.v[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    for (i = 0; i < cdecs.n; i++) {
+        if (cdecs.v[i] < 0 || cdecs.v[i] > CRT_CHROMA_DEC_MAX) {
+            printf("bad chroma decimation %d\n", cdecs.v[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    for (i = 0; i < mdecs.n; i++) {
+        if (mdecs.v[i] < 0 || mdecs.v[i] > CRT_CHROMA_DEC_MAX) {
+            printf("bad chroma decimation %d\n", mdecs.v[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (fields < 1) {
+        fields = 1;
+    }
+    if (reps < 1) {
+        reps = 1;
+    }
+    if (threads != 1) {
+        pool = crt_pool_create(threads);
+        if (pool == NULL) {
+            printf("out of memory\n");
+            return EXIT_FAILURE;
+        }
+    }
+    threads = crt_pool_size(pool);
+
+    printf("op,system,format,width,height,noise,blend,scanlines,reuse,"
+           "quality,chroma_dec,threads,fields,ns_field,fields_sec,ns_sample\n");
+    for (i = 0; i < systems.n; i++) {
+        sys = systems.v[i];
+        for (j = 0; j < formats.n; j++) {
+            fmt = formats.v[j];
+            s = bench_sys[sys]->create(fmt);
+            out = malloc(ws.v[0] * hs.v[0] * 4);
+            if (s == NULL || out == NULL) {
+                printf("out of memory\n");
+                return EXIT_FAILURE;
+            }
+            crt_init_sys(&crt, sys, ws.v[0], hs.v[0], fmt, out);
+            /* the first fields set up the sync and blanking */
+            time_mod(s, bench_sys[sys], 0, 2, pool);
+            for (k = 0; k < mdecs.n; k++) {
+                c = mdecs.v[k];
+                if (bench_sys[sys]->chroma_dec) {
+                    bench_sys[sys]->chroma_dec(s, c);
+                } else if (c != 0) {
+                    continue;
+                }
+                best = 0;
+                for (r = 0; r < reps; r++) {
+                    t = time_mod(s, bench_sys[sys], 2 + r * fields, fields, pool);
+                    if (r == 0 || t < best) {
+                        best = t;
+                    }
+                }
+                report("mod", sys, fmt, 0, 0, 0, 0, 0, c, threads, fields,
+                        best / fields);
+            }
+            free(out);
+
+            for (a = 0; a < ws.n; a++) {
+                out = calloc(ws.v[a] * hs.v[a], 4);
+                if (out == NULL) {
+                    printf("out of memory\n");
+                    return EXIT_FAILURE;
+                }
+                crt_resize(&crt, ws.v[a], hs.v[a], fmt, out);
+                for (b = 0; b < noises.n; b++) {
+                    for (k = 0; k < modes.n * qualities.n * cdecs.n; k++) {
+                        m = modes.v[k % modes.n];
+                        q = qualities.v[k / modes.n % qualities.n];
+                        c = cdecs.v[k / modes.n / qualities.n];
+                        crt.blend = m & 1;
+                        crt.scanlines = (m >> 1) & 1;
+                        crt.reuse = (m >> 2) & 1;
+                        crt.quality = q;
+                        crt.chroma_dec = c;
+                        time_demod(noises.v[b], 1, pool);
+                        best = 0;
+                        for (r = 0; r < reps; r++) {
+                            t = time_demod(noises.v[b], fields, pool);
+                            if (r == 0 || t < best) {
+                                best = t;
+                            }
+                        }
+                        report("demod", sys, fmt, ws.v[a], hs.v[a],
+                                noises.v[b], m, q, c, threads, fields,
+                                best / fields);
+                    }
+                }
+                if (bench_sys[sys]->fast) {
+                    crt.blend = 0;
+                    crt.scanlines = 0;
+                    crt.reuse = 0;
+                    /* the tables are made with these, not the last ones
+                     * the demod rows left behind
+                     */
+                    crt.quality = CRT_QUALITY_DEFAULT;
+                    crt.chroma_dec = 0;
+                    /* the first one makes the tables */
+                    time_fast(s, bench_sys[sys], 0, 1);
+                    best = 0;
+                    for (r = 0; r < reps; r++) {
+                        t = time_fast(s, bench_sys[sys], 1 + r * fields, fields);
+                        if (r == 0 || t < best) {
+                            best = t;
+                        }
+                    }
+                    report("fast", sys, fmt, ws.v[a], hs.v[a],
+                            0, 0, CRT_QUALITY_DEFAULT, 0, 1, fields,
+                            best / fields);
+                }
+                free(out);
+            }
+            free(s);
+            fflush(stdout);
+        }
+    }
+    crt_pool_destroy(pool);
+    return EXIT_SUCCESS;
+}
@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 
 #include "bmp_rw.h"
 
@@ -19,78 +20,204 @@
  * BMP image reader/writer kindly provided by 'deqmega' https://github.com/DEQ2000-cyber
  */
 
-static unsigned char *
-loadBMP(char *file, unsigned int *w, unsigned int *h, unsigned char *bpp,
-        void *(*calloc_func)(size_t, size_t))
+#define FILE_HEADER 14
+#define INFO_HEADER 40
+#define MAX_HEADER  (FILE_HEADER + 124) /* BITMAPV5HEADER */
+
+#define BI_RGB       0
+#define BI_BITFIELDS 3
+
+static unsigned int
+get16(unsigned char *p)
 {
-    FILE *f;
-    unsigned char header[54];
-    unsigned char pad[3];
-    unsigned char *data = NULL;
-    unsigned int width, height, size;
-    unsigned char BPP, padding;
-    unsigned int X;
-    int Y;
-    
-    f = fopen(file, "rb");
-    if (f == NULL) {
-        return NULL;
+    return p[0] | p[1] << 8;
+}
+
+static unsigned int
+get32(unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int) p[3] << 24;
+}
+
+static void
+put32(unsigned char *p, unsigned int v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/* turns a BI_BITFIELDS channel mask into a shift and a scale to 8 bits */
+static void
+mask_shift(unsigned int mask, int *shift, unsigned int *max)
+{
+    *shift = 0;
+    *max = 0;
+    if (mask == 0) {
+        return;
     }
-    fread(header, sizeof(unsigned char), 54, f);
-    width = *(int*) &header[18];
-    height = *(int*) &header[22];
-    BPP = *(int*) &header[28];
-    size = (width * height * (BPP / 8));
-    padding = ((4 - (width * (BPP / 8)) % 4) % 4);
-    data = calloc_func(size, (BPP / 8));
-    if (data == NULL) {
-        return NULL;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        (*shift)++;
     }
-    fseek(f, 54, SEEK_SET);
-    for (Y = height - 1; Y >= 0; Y--) {
-        for (X = 0; X < width; X++) {
-            fread(&data[(Y * width + X) * (BPP / 8)], (BPP / 8), 1, f);
-        }
-        fread(pad, padding, 1, f);
+    *max = mask;
+}
+
+static int
+mask_get(unsigned int px, int shift, unsigned int max)
+{
+    if (max == 0) {
+        return 0;
     }
-    fclose(f), f = NULL;
-    *w = width;
-    *h = height;
-    *bpp = BPP;
-    return data;
+    return (((px >> shift) & max) * 255 + max / 2) / max;
 }
 
 static void *
-loadBMPconverter(char *file, int *w, int *h,
+loadBMP(char *file, int *w, int *h,
         void *(*calloc_func)(size_t, size_t))
 {
-    unsigned int *data = NULL;
-    unsigned int x, y, i;
-    unsigned char n;
-    unsigned char *p;
-    unsigned int *pix;
-    
-    p = loadBMP(file, &x, &y, &n, calloc_func);
-    if (p == NULL) {
+    FILE *f;
+    unsigned char header[MAX_HEADER];
+    unsigned char pal[256][4];
+    unsigned char *row = NULL, *p;
+    unsigned int *data = NULL, *out;
+    unsigned int offset, info, comp, ncolors, stride, px, uw, uh;
+    unsigned int mask[3], max[3];
+    int shift[3];
+    int width, height, bpp, topdown;
+    int x, y, i;
+
+    f = fopen(file, "rb");
+    if (f == NULL) {
+        printf("[bmp_rw] unable to open bmp: %s\n", file);
         return NULL;
     }
-    *w = x;
-    *h = y;
-    data = calloc_func(x * y, sizeof(unsigned int));
-    if (data == NULL) {
-        return NULL;
+    if (fread(header, 1, FILE_HEADER + INFO_HEADER, f) != FILE_HEADER + INFO_HEADER ||
+            header[0] != 'B' || header[1] != 'M') {
+        printf("[bmp_rw] invalid bmp: %s\n", file);
+        goto err;
+    }
+    offset = get32(header + 10);
+    info = get32(header + 14);
+    if (info < INFO_HEADER || info > MAX_HEADER - FILE_HEADER) {
+        printf("[bmp_rw] unsupported bmp header: %s\n", file);
+        goto err;
+    }
+    /* the rest of a V4/V5 header, or the masks that follow a plain one */
+    i = (info > INFO_HEADER) ? (int) info - INFO_HEADER : 12;
+    if (i > MAX_HEADER - FILE_HEADER - INFO_HEADER) {
+        i = MAX_HEADER - FILE_HEADER - INFO_HEADER;
+    }
+    memset(header + FILE_HEADER + INFO_HEADER, 0, i);
+    fread(header + FILE_HEADER + INFO_HEADER, 1, i, f);
+
+    uw = get32(header + 18);
+    uh = get32(header + 22);
+    bpp = get16(header + 28);
+    comp = get32(header + 30);
+    ncolors = get32(header + 46);
+    /* a negative height is a top-down image, negated as unsigned
+     * so the most negative one stays too big instead of overflowing
+     */
+    topdown = (uh & 0x80000000U) != 0;
+    if (topdown) {
+        uh = (0 - uh) & 0xffffffffU;
+    }
+    /* a row of 32-bit pixels in bits and the pixel count have to fit */
+    if (uw == 0 || uh == 0 || uw > (INT_MAX - 31) / 32 ||
+            uh > (unsigned int) INT_MAX / uw) {
+        printf("[bmp_rw] invalid bmp [bad dim]: %s\n", file);
+        goto err;
+    }
+    width = (int) uw;
+    height = (int) uh;
+    if ((bpp != 8 && bpp != 24 && bpp != 32) ||
+            !(comp == BI_RGB || (comp == BI_BITFIELDS && bpp == 32))) {
+        printf("[bmp_rw] unsupported bmp [%d-bit, compression %u]: %s\n",
+                bpp, comp, file);
+        goto err;
+    }
+    if (comp == BI_BITFIELDS) {
+        for (i = 0; i < 3; i++) {
+            mask[i] = get32(header + 54 + i * 4);
+            mask_shift(mask[i], &shift[i], &max[i]);
+        }
+    }
+    if (bpp == 8) {
+        if (ncolors == 0 || ncolors > 256) {
+            ncolors = 256;
+        }
+        memset(pal, 0, sizeof(pal));
+        if (fseek(f, FILE_HEADER + info, SEEK_SET) != 0 ||
+                fread(pal, 4, ncolors, f) != ncolors) {
+            printf("[bmp_rw] invalid bmp [no palette]: %s\n", file);
+            goto err;
+        }
     }
-    pix = data;
-    if ((n / 8) == 4) {
-        memcpy(pix, p, (x * y * sizeof(unsigned int)));
-        free(p);
-        return data;
+
+    /* rows are padded to 4 bytes */
+    stride = ((width * bpp + 31) / 32) * 4;
+    row = malloc(stride);
+    data = calloc_func((size_t) width * height, sizeof(int));
+    if (row == NULL || data == NULL) {
+        printf("[bmp_rw] out of memory loading bmp: %s\n", file);
+        goto err;
     }
-    for (i = 0; i < (x * y * (n / 8)); i += (n / 8)) {
-        *(pix++) = (p[i] << 0) | (p[i + 1] << 8) | (p[i + 2] << 16) | (255 << 24);
+    if (fseek(f, offset, SEEK_SET) != 0) {
+        printf("[bmp_rw] invalid bmp [bad offset]: %s\n", file);
+        goto err;
     }
-    free(p);
+    for (y = 0; y < height; y++) {
+        if (fread(row, 1, stride, f) != stride) {
+            printf("[bmp_rw] early eof: %s\n", file);
+            goto err;
+        }
+        out = data + (topdown ? y : (height - 1 - y)) * width;
+        p = row;
+        switch (bpp) {
+            case 8:
+                for (x = 0; x < width; x++) {
+                    i = *p++;
+                    out[x] = pal[i][0] | pal[i][1] << 8 | pal[i][2] << 16 | 0xffU << 24;
+                }
+                break;
+            case 24:
+                for (x = 0; x < width; x++) {
+                    out[x] = p[0] | p[1] << 8 | p[2] << 16 | 0xffU << 24;
+                    p += 3;
+                }
+                break;
+            case 32:
+                if (comp == BI_RGB) {
+                    for (x = 0; x < width; x++) {
+                        out[x] = p[0] | p[1] << 8 | p[2] << 16 | 0xffU << 24;
+                        p += 4;
+                    }
+                    break;
+                }
+                for (x = 0; x < width; x++) {
+                    px = get32(p);
+                    out[x] = mask_get(px, shift[2], max[2])
+                           | mask_get(px, shift[1], max[1]) << 8
+                           | mask_get(px, shift[0], max[0]) << 16
+                           | 0xffU << 24;
+                    p += 4;
+                }
+                break;
+        }
+    }
+    free(row);
+    fclose(f);
+    *w = width;
+    *h = height;
     return data;
+err:
+    /* what calloc_func gives is freed with free() like everything else */
+    free(data);
+    free(row);
+    fclose(f);
+    return NULL;
 }
 
 static int
@@ -98,49 +225,52 @@ saveBMP(char *file, int *data, unsigned int w,
         unsigned int h)
 {
     FILE *f;
-    unsigned int filesize;
-    unsigned char pad[3], header[14], info[40];
-    unsigned char padding;
+    unsigned int filesize, stride;
+    unsigned char header[FILE_HEADER + INFO_HEADER];
+    unsigned char *row;
     unsigned int X;
     int Y, bpp = 4;
-    
+
     if (data == NULL) {
         return 0;
     }
-    padding = ((4 - (w * bpp) % 4) % 4);
+    /* 32-bit rows never need padding */
+    stride = w * bpp;
     memset(header, 0, sizeof(header));
-    memset(info, 0, sizeof(info));
-    filesize = 14 + 40 + w * h * bpp + padding * w;
+    filesize = FILE_HEADER + INFO_HEADER + stride * h;
     header[0] = 'B';
     header[1] = 'M';
-    header[2] = filesize;
-    header[3] = filesize >> 8;
-    header[4] = filesize >> 16;
-    header[5] = filesize >> 24;
-    header[10] = 14 + 40;
-    info[0] = 40;
-    info[4]  = (w >>  0) & 0xff;
-    info[5]  = (w >>  8) & 0xff;
-    info[6]  = (w >> 16) & 0xff;
-    info[7]  = (w >> 24) & 0xff;
-    info[8]  = (h >>  0) & 0xff;
-    info[9]  = (h >>  8) & 0xff;
-    info[10] = (h >> 16) & 0xff;
-    info[11] = (h >> 24) & 0xff;
-    info[12] = 1;
-    info[14] = bpp * 8;
+    put32(header + 2, filesize);
+    put32(header + 10, FILE_HEADER + INFO_HEADER);
+    put32(header + 14, INFO_HEADER);
+    put32(header + 18, w);
+    put32(header + 22, h);
+    header[26] = 1;
+    header[28] = bpp * 8;
+    row = malloc(stride);
+    if (row == NULL) {
+        printf("[bmp_rw] out of memory writing bmp: %s\n", file);
+        return 0;
+    }
     f = fopen(file, "wb");
     if (f == NULL) {
+        printf("[bmp_rw] failed to write file: %s\n", file);
+        free(row);
         return 0;
     }
-    fwrite(header, 14, 1, f);
-    fwrite(info, 40, 1, f);
+    fwrite(header, sizeof(header), 1, f);
     for (Y = h - 1; Y >= 0; Y--) {
         for (X = 0; X < w; X++) {
-            fwrite(&data[Y * w + X], sizeof(int), 1, f);
+            put32(row + X * bpp, data[Y * w + X]);
+        }
+        if (fwrite(row, 1, stride, f) != stride) {
+            printf("[bmp_rw] failed to write file: %s\n", file);
+            free(row);
+            fclose(f);
+            return 0;
         }
-        fwrite(pad, padding, 1, f);
     }
+    free(row);
     fclose(f);
     return 1;
 }
@@ -149,7 +279,7 @@ extern int
 bmp_read24(char *file, int **out_color, int *out_w, int *out_h,
         void *(*calloc_func)(size_t, size_t))
 {
-    *out_color = loadBMPconverter(file, out_w, out_h, calloc_func);
+    *out_color = loadBMP(file, out_w, out_h, calloc_func);
     return (*out_color != NULL);
 }
 
@@ -15,6 +15,9 @@
  *
  * Routines to read and write BMP images. Kindly provided by 'deqmega' https://github.com/DEQ2000-cyber
  *
+ * Uncompressed 8-bit (palette), 24-bit and 32-bit images can be read,
+ * bottom-up or top-down. Images are written as 32-bit bottom-up.
+ *
  */
 
 extern int bmp_read24(char *file,
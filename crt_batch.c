@@ -0,0 +1,124 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+#include "crt_batch.h"
+#include "crt_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct CRT_BATCH {
+    struct CRT_POOL *pool;
+    int n; /* number of CRTs, one per thread of the pool */
+    struct CRT *crt[CRT_POOL_MAX];
+    int rn; /* noise seed of a freshly initialized CRT */
+    struct CRT_BATCH_JOB *jobs;
+};
+
+extern struct CRT_BATCH *
+crt_batch_create(int nthreads)
+{
+    struct CRT_BATCH *b;
+    int i;
+
+    b = calloc(1, sizeof(struct CRT_BATCH));
+    if (b == NULL) {
+        return NULL;
+    }
+    b->pool = crt_pool_create(nthreads);
+    if (b->pool == NULL) {
+        free(b);
+        return NULL;
+    }
+    b->n = crt_pool_size(b->pool);
+    for (i = 0; i < b->n; i++) {
+        b->crt[i] = malloc(sizeof(struct CRT));
+        if (b->crt[i] == NULL) {
+            crt_batch_destroy(b);
+            return NULL;
+        }
+        /* the filters only depend on the system, the output is per job */
+        crt_init_sys(b->crt[i], CRT_SYSTEM, 0, 0, CRT_PIX_FORMAT_RGB, NULL);
+    }
+    b->rn = b->crt[0]->rn;
+    return b;
+}
+
+extern void
+crt_batch_destroy(struct CRT_BATCH *b)
+{
+    int i;
+
+    if (b == NULL) {
+        return;
+    }
+    for (i = 0; i < b->n; i++) {
+        free(b->crt[i]);
+    }
+    crt_pool_destroy(b->pool);
+    free(b);
+}
+
+static void
+run_job(void *ctx, int job, int worker)
+{
+    struct CRT_BATCH *b = ctx;
+    struct CRT_BATCH_JOB *j = &b->jobs[job];
+    struct CRT *v = b->crt[worker];
+    const struct CRT *m = j->monitor;
+    int i;
+
+    /* starts from a clean signal, sync and noise seed so the output
+     * doesn't depend on which jobs ran on this CRT before
+     */
+    crt_resize(v, j->outw, j->outh, j->out_format, j->out);
+    crt_reset(v);
+    crt_refresh(v);
+    v->rn = b->rn;
+    memset(v->analog, 0, v->sys->hres * v->sys->vres);
+    /* the sync and blanking went with it, also when this job ran before */
+    j->s->field_initialized = 0;
+    if (m) {
+        v->hue = m->hue;
+        v->brightness = m->brightness;
+        v->contrast = m->contrast;
+        v->saturation = m->saturation;
+        v->black_point = m->black_point;
+        v->white_point = m->white_point;
+        v->blend = m->blend;
+        v->scanlines = m->scanlines;
+    } else {
+        v->blend = 1;
+        v->scanlines = 1;
+    }
+    for (i = 0; i < j->fields; i++) {
+        crt_modulate(v, j->s);
+        crt_demodulate(v, j->noise);
+#if (CRT_SYSTEM != CRT_SYSTEM_NES)
+        /* NES mode is always progressive */
+        if (!j->progressive) {
+            j->s->field ^= 1;
+            if (j->s->field == 0) {
+                /* a frame is two fields */
+                j->s->frame ^= 1;
+            }
+        }
+#endif
+    }
+}
+
+extern void
+crt_batch_run(struct CRT_BATCH *b, struct CRT_BATCH_JOB *jobs, int njobs)
+{
+    b->jobs = jobs;
+    crt_pool_run(b->pool, run_job, b, njobs);
+    b->jobs = NULL;
+}
@@ -0,0 +1,81 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#ifndef _CRT_BATCH_H_
+#define _CRT_BATCH_H_
+
+#include "crt_core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* crt_batch.h
+ *
+ * Runs many independent images through the modulate/demodulate sequence,
+ * one image per thread at a time. Every thread of the pool has a CRT of
+ * its own whose filters are set up once, each job it takes only starts
+ * over with a clean signal and its own output and monitor settings, so
+ * nothing is allocated or set up again per image. Threads take the next
+ * job as soon as they finish one, so slow and fast jobs even out across
+ * the threads.
+ *
+ * The images are of the system CRT_SYSTEM (see crt_core.h) this file was
+ * compiled with.
+ *
+ *   struct CRT_BATCH *b = crt_batch_create(0);
+ *   ...fill in jobs[0 .. n - 1]...
+ *   crt_batch_run(b, jobs, n);
+ *   crt_batch_destroy(b);
+ *
+ */
+
+struct CRT_BATCH_JOB {
+    /* the image and the modulator settings. Each job needs its own since
+     * the modulator keeps state in it, start with it zeroed out
+     */
+    struct NTSC_SETTINGS *s;
+    unsigned char *out; /* output image */
+    int outw, outh, out_format;
+    int fields; /* number of fields decoded onto the output */
+    int progressive; /* 0 = the fields alternate between even and odd */
+    int noise;
+    /* hue, brightness, contrast, saturation, black_point, white_point,
+     * blend and scanlines are taken from here, NULL = the defaults with
+     * blend and scanlines on like the command line program
+     */
+    const struct CRT *monitor;
+};
+
+struct CRT_BATCH;
+
+/* Creates a batch runner
+ *   nthreads - total number of threads including the calling thread,
+ *              0 or less means one per processor
+ *
+ * returns NULL if out of memory
+ */
+extern struct CRT_BATCH *crt_batch_create(int nthreads);
+
+/* Frees the runner and its threads */
+extern void crt_batch_destroy(struct CRT_BATCH *b);
+
+/* Runs every job and returns when they are all done. The output of a job
+ * is the same as running it on its own. Only one thread at a time may run
+ * jobs on a given runner.
+ */
+extern void crt_batch_run(struct CRT_BATCH *b,
+        struct CRT_BATCH_JOB *jobs, int njobs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
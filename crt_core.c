@@ -9,6 +9,7 @@
  */
 /*****************************************************************************/
 #include "crt_core.h"
+#include "crt_pool.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -16,7 +17,7 @@
 /* ensure negative values for x get properly modulo'd */
 #define POSMOD(x, n)     (((x) % (n) + (n)) % (n))
 
-static int sigpsin15[18] = { /* significant points on sine wave (15-bit) */
+static const int sigpsin15[18] = { /* significant points on sine wave (15-bit) */
     0x0000,
     0x0c88,0x18f8,0x2528,0x30f8,0x3c50,0x4718,0x5130,0x5a80,
     0x62f0,0x6a68,0x70e0,0x7640,0x7a78,0x7d88,0x7f60,0x8000,
@@ -81,87 +82,9 @@ crt_bpp4fmt(int format)
 /********************************* FILTERS ***********************************/
 /*****************************************************************************/
 
-/* convolution is much faster but the EQ looks softer, more authentic, and more analog */
-#define USE_CONVOLUTION 0
-#define USE_7_SAMPLE_KERNEL 1
-#define USE_6_SAMPLE_KERNEL 0
-#define USE_5_SAMPLE_KERNEL 0
-
-#if (CRT_CC_SAMPLES != 4)
-/* the current convolutions do not filter properly at > 4 samples */
-#undef USE_CONVOLUTION
-#define USE_CONVOLUTION 0
-#endif
-
-#if USE_CONVOLUTION
-
-/* NOT 3 band equalizer, faster convolution instead.
- * eq function names preserved to keep code clean
- */
-static struct EQF {
-    int h[7];
-} eqY, eqI, eqQ;
-
-/* params unused to keep the function the same */
-static void
-init_eq(struct EQF *f,
-        int f_lo, int f_hi, int rate,
-        int g_lo, int g_mid, int g_hi)
-{    
-    memset(f, 0, sizeof(struct EQF));
-}
-
-static void
-reset_eq(struct EQF *f)
-{
-    memset(f->h, 0, sizeof(f->h));
-}
-
-static int
-eqf(struct EQF *f, int s)
-{
-    int i;
-    int *h = f->h;
-
-    for (i = 6; i > 0; i--) {
-        h[i] = h[i - 1];
-    }
-    h[0] = s;
-#if USE_7_SAMPLE_KERNEL
-    /* index : 0 1 2 3 4 5 6 */
-    /* weight: 1 4 7 8 7 4 1 */
-    return (s + h[6] + ((h[1] + h[5]) * 4) + ((h[2] + h[4]) * 7) + (h[3] * 8)) >> 5;
-#elif USE_6_SAMPLE_KERNEL
-    /* index : 0 1 2 3 4 5 */
-    /* weight: 1 3 4 4 3 1 */
-    return (s + h[5] + 3 * (h[1] + h[4]) + 4 * (h[2] + h[3])) >> 4;
-#elif USE_5_SAMPLE_KERNEL
-    /* index : 0 1 2 3 4 */
-    /* weight: 1 2 2 2 1 */
-    return (s + h[4] + ((h[1] + h[2] + h[3]) << 1)) >> 3;
-#else
-    /* index : 0 1 2 3 */
-    /* weight: 1 1 1 1*/
-    return (s + h[3] + h[1] + h[2]) >> 2;
-#endif
-}
-
-#else
-
-#define HISTLEN     3
-#define HISTOLD     (HISTLEN - 1) /* oldest entry */
-#define HISTNEW     0             /* newest entry */
-
 #define EQ_P        16 /* if changed, the gains will need to be adjusted */
 #define EQ_R        (1 << (EQ_P - 1)) /* rounding */
 /* three band equalizer */
-static struct EQF {
-    int lf, hf; /* fractions */
-    int g[3]; /* gains */
-    int fL[4];
-    int fH[4];
-    int h[HISTLEN]; /* history */
-} eqY, eqI, eqQ;
 
 /* f_lo - low cutoff frequency
  * f_hi - high cutoff frequency
@@ -195,6 +118,33 @@ init_eq(struct EQF *f,
     }
 }
 
+/* the one pole fraction that does d = 2^k steps of fraction a in one */
+static int
+pole_dec(int a, int k)
+{
+    unsigned p;
+
+    if (a <= 0 || a >= (1 << EQ_P)) {
+        return a;
+    }
+    p = (1 << EQ_P) - a;
+    while (k-- > 0) {
+        p = (p * p + EQ_R) >> EQ_P;
+    }
+    return (1 << EQ_P) - p;
+}
+
+/* turns an EQ made by init_eq() into one that runs at 1 / 2^k of the rate.
+ * The poles are moved so the impulse response decays the same per unit of
+ * time, taking 2 sin(pi f / rate) at the lower rate would overshoot.
+ */
+static void
+decimate_eq(struct EQF *f, int k)
+{
+    f->lf = pole_dec(f->lf, k);
+    f->hf = pole_dec(f->hf, k);
+}
+
 static void
 reset_eq(struct EQF *f)
 {
@@ -232,6 +182,205 @@ eqf(struct EQF *f, int s)
     return (r[0] + r[1] + r[2]);
 }
 
+#define EQ_FIR_P 12 /* precision of the taps */
+#define EQ_FIR_R (1 << (EQ_FIR_P - 1))
+
+/* The EQ is linear apart from its rounding, so its output is the input
+ * convolved with its impulse response. The response is taken by running
+ * the EQ itself on an impulse, it dies out within CRT_EQ_TAPS samples
+ * for the cutoffs the systems use.
+ */
+static void
+init_fir(struct EQF *f)
+{
+    struct EQF t = *f;
+    struct EQ_FIR *fir = &f->fir;
+    int k;
+
+    reset_eq(&t);
+    /* eqf() truncates each band that isn't passed at unity gain, which
+     * takes half a step off on average. The FIR is rounded to match.
+     */
+    fir->round = EQ_FIR_R;
+    for (k = 0; k < 3; k++) {
+        if (f->g[k] != 0 && f->g[k] != (1 << EQ_P)) {
+            fir->round -= EQ_FIR_R;
+        }
+    }
+    fir->ntaps = 0;
+    for (k = 0; k < CRT_EQ_TAPS; k++) {
+        fir->taps[k] = eqf(&t, (k == 0) ? (1 << EQ_FIR_P) : 0);
+        if (fir->taps[k] != 0) {
+            fir->ntaps = k + 1;
+        }
+    }
+    fir->ntaps = (fir->ntaps + 3) & ~3;
+}
+
+#if USE_7_SAMPLE_KERNEL
+#define BOX_SMOOTH 3
+#elif USE_6_SAMPLE_KERNEL
+#define BOX_SMOOTH 2
+#elif USE_5_SAMPLE_KERNEL
+#define BOX_SMOOTH 1
+#else
+#define BOX_SMOOTH 0
+#endif
+
+/* NOT 3 band equalizer, faster convolution instead.
+ * An average over one chroma period, which removes the carrier, convolved
+ * BOX_SMOOTH times with 1 1. With 4 samples per chroma period these are
+ *   7 sample kernel: 1 4 7 8 7 4 1
+ *   6 sample kernel: 1 3 4 4 3 1
+ *   5 sample kernel: 1 2 2 2 1
+ *   4 sample kernel: 1 1 1 1
+ */
+static void
+init_box(struct EQ_FIR *f, int cc)
+{
+    int i, k, n, sum;
+
+    memset(f, 0, sizeof(struct EQ_FIR));
+    for (k = 0; k < cc; k++) {
+        f->taps[k] = 1;
+    }
+    for (i = 0; i < BOX_SMOOTH; i++) {
+        for (k = cc + i; k > 0; k--) {
+            f->taps[k] += f->taps[k - 1];
+        }
+    }
+    n = cc + BOX_SMOOTH;
+    sum = cc << BOX_SMOOTH;
+    for (k = 0; k < n; k++) {
+        f->taps[k] = (f->taps[k] * (1 << EQ_FIR_P) + sum / 2) / sum;
+    }
+    f->ntaps = (n + 3) & ~3;
+    f->round = 0; /* rounds down like the EQ */
+}
+
+/* number of samples summed into one for chroma at 1 / 2^cs of the rate.
+ * 2^cs if that cancels the carrier's second harmonic that demodulating
+ * leaves behind, else a whole chroma period.
+ */
+static int
+chroma_win(int cc, int cs)
+{
+    if (cs == 0) {
+        return 1;
+    }
+    return ((2 << cs) % cc == 0) ? (1 << cs) : cc;
+}
+
+/* delay of a FIR in 1/4096 samples, the center of its taps */
+static int
+fir_delay(const struct EQ_FIR *f)
+{
+    int k, sum = 0, mom = 0;
+
+    for (k = 0; k < f->ntaps; k++) {
+        sum += f->taps[k];
+        mom += k * f->taps[k];
+    }
+    return (sum == 0) ? 0 : (mom << 12) / sum;
+}
+
+/* Where the chroma that was filtered at 1 / 2^cs of the rate sits, in
+ * 1/4096 samples: chroma sample g is taken as sample (g << cs) + offset.
+ * That is the middle of its chroma_win() plus the delay the filters at the
+ * full rate have more than the ones at the reduced rate.
+ *   full, dec - the filter at the full and at the reduced rate
+ */
+static int
+chroma_offset(const struct EQ_FIR *full, const struct EQ_FIR *dec, int cc, int cs)
+{
+    int d = 1 << cs;
+
+    return ((d - 1) << 12) - ((chroma_win(cc, cs) - 1) << 11) +
+            fir_delay(full) - d * fir_delay(dec);
+}
+
+/* filters n samples at once
+ *   x - input, x[-CRT_EQ_TAPS] to x[-1] must be 0 (the reset EQ)
+ *   y - output
+ */
+static void
+fir_line(const struct EQ_FIR *f, const int *x, int n, int *y)
+{
+    int i, k, t0, t1, t2, t3;
+
+    for (i = 0; i < n; i++) {
+        y[i] = f->round;
+    }
+    /* four taps per pass, ntaps is a multiple of 4 */
+    for (k = 0; k < f->ntaps; k += 4) {
+        t0 = f->taps[k + 0];
+        t1 = f->taps[k + 1];
+        t2 = f->taps[k + 2];
+        t3 = f->taps[k + 3];
+        for (i = 0; i < n; i++) {
+            y[i] += t0 * x[i - k] + t1 * x[i - k - 1]
+                  + t2 * x[i - k - 2] + t3 * x[i - k - 3];
+        }
+    }
+    for (i = 0; i < n; i++) {
+        y[i] >>= EQ_FIR_P;
+    }
+}
+
+#if (CRT_EQ_LANES > 1)
+#define EQ_LANES 1
+/* the state of CRT_EQ_LANES equalizers, lanes next to each other */
+struct EQL {
+    int fL[4][CRT_EQ_LANES];
+    int fH[4][CRT_EQ_LANES];
+    int h[HISTLEN][CRT_EQ_LANES];
+};
+
+/* eqf() for one sample of every lane, x is replaced by the result.
+ * Every lane goes through the whole cascade in one pass of the loop, which
+ * the compiler can turn into vector instructions across the lanes.
+ */
+static void
+eqf_lanes(const struct EQF *f, struct EQL *e, int *x)
+{
+    int lf = f->lf;
+    int hf = f->hf;
+    int g0 = f->g[0];
+    int g1 = f->g[1];
+    int g2 = f->g[2];
+    int l;
+
+    for (l = 0; l < CRT_EQ_LANES; l++) {
+        int s = x[l];
+        int L0, L1, L2, L3, H0, H1, H2, H3;
+
+        L0 = e->fL[0][l] + ((lf * (s  - e->fL[0][l]) + EQ_R) >> EQ_P);
+        H0 = e->fH[0][l] + ((hf * (s  - e->fH[0][l]) + EQ_R) >> EQ_P);
+        L1 = e->fL[1][l] + ((lf * (L0 - e->fL[1][l]) + EQ_R) >> EQ_P);
+        H1 = e->fH[1][l] + ((hf * (H0 - e->fH[1][l]) + EQ_R) >> EQ_P);
+        L2 = e->fL[2][l] + ((lf * (L1 - e->fL[2][l]) + EQ_R) >> EQ_P);
+        H2 = e->fH[2][l] + ((hf * (H1 - e->fH[2][l]) + EQ_R) >> EQ_P);
+        L3 = e->fL[3][l] + ((lf * (L2 - e->fL[3][l]) + EQ_R) >> EQ_P);
+        H3 = e->fH[3][l] + ((hf * (H2 - e->fH[3][l]) + EQ_R) >> EQ_P);
+        e->fL[0][l] = L0;
+        e->fL[1][l] = L1;
+        e->fL[2][l] = L2;
+        e->fL[3][l] = L3;
+        e->fH[0][l] = H0;
+        e->fH[1][l] = H1;
+        e->fH[2][l] = H2;
+        e->fH[3][l] = H3;
+
+        x[l] = ((L3 * g0) >> EQ_P) +
+               (((H3 - L3) * g1) >> EQ_P) +
+               (((e->h[HISTOLD][l] - H3) * g2) >> EQ_P);
+        e->h[2][l] = e->h[1][l];
+        e->h[1][l] = e->h[0][l];
+        e->h[0][l] = s;
+    }
+}
+#else
+#define EQ_LANES 0
 #endif
 
 /*****************************************************************************/
@@ -260,81 +409,171 @@ crt_reset(struct CRT *v)
     v->vsync = 0;
 }
 
-extern void
-crt_init(struct CRT *v, int w, int h, int f, unsigned char *out)
+extern const struct CRT_SYS *
+crt_get_sys(int system)
+{
+    switch (system) {
+        case CRT_SYSTEM_NTSC:
+            return &crt_sys_ntsc;
+        case CRT_SYSTEM_NES:
+            return &crt_sys_nes;
+        case CRT_SYSTEM_PV1K:
+            return &crt_sys_pv1k;
+        default:
+            return NULL;
+    }
+}
+
+extern int
+crt_init_sys(struct CRT *v, int system,
+        int w, int h, int f, unsigned char *out)
 {
+    const struct CRT_SYS *sys = crt_get_sys(system);
+    int k, n;
+
+    if (sys == NULL) {
+        return 0;
+    }
     memset(v, 0, sizeof(struct CRT));
+    v->analog = v->analog_buf;
     crt_resize(v, w, h, f, out);
     crt_reset(v);
+    v->sys = sys;
     v->rn = 194;
     
     /* kilohertz to line sample conversion */
-#define kHz2L(kHz) (CRT_HRES * (kHz * 100) / L_FREQ)
+#define kHz2L(kHz) (sys->hres * (kHz * 100) / sys->l_freq)
     
     /* band gains are pre-scaled as 16-bit fixed point
      * if you change the EQ_P define, you'll need to update these gains too
      */
-#if (CRT_CC_SAMPLES == 4)
-    init_eq(&eqY, kHz2L(1500), kHz2L(3000), CRT_HRES, 65536, 8192, 9175);  
-    init_eq(&eqI, kHz2L(80),   kHz2L(1150), CRT_HRES, 65536, 65536, 1311);
-    init_eq(&eqQ, kHz2L(80),   kHz2L(1000), CRT_HRES, 65536, 65536, 0);
-#elif (CRT_CC_SAMPLES == 5)
-    init_eq(&eqY, kHz2L(1500), kHz2L(3000), CRT_HRES, 65536, 12192, 7775);
-    init_eq(&eqI, kHz2L(80),   kHz2L(1150), CRT_HRES, 65536, 65536, 1311);
-    init_eq(&eqQ, kHz2L(80),   kHz2L(1000), CRT_HRES, 65536, 65536, 0);
-#else
-#error "NTSC-CRT currently only supports 4 or 5 samples per chroma period."
-#endif
+    if (sys->cc_samples == 4) {
+        init_eq(&v->eqY, kHz2L(1500), kHz2L(3000), sys->hres, 65536, 8192, 9175);  
+        init_eq(&v->eqI, kHz2L(80),   kHz2L(1150), sys->hres, 65536, 65536, 1311);
+        init_eq(&v->eqQ, kHz2L(80),   kHz2L(1000), sys->hres, 65536, 65536, 0);
+    } else {
+        /* NTSC-CRT currently only supports 4 or 5 samples per chroma period */
+        init_eq(&v->eqY, kHz2L(1500), kHz2L(3000), sys->hres, 65536, 12192, 7775);
+        init_eq(&v->eqI, kHz2L(80),   kHz2L(1150), sys->hres, 65536, 65536, 1311);
+        init_eq(&v->eqQ, kHz2L(80),   kHz2L(1000), sys->hres, 65536, 65536, 0);
+    }
+    for (k = 0; k < CRT_CHROMA_DEC_MAX; k++) {
+        v->eqIdec[k] = v->eqI;
+        v->eqQdec[k] = v->eqQ;
+        decimate_eq(&v->eqIdec[k], k + 1);
+        decimate_eq(&v->eqQdec[k], k + 1);
+        init_fir(&v->eqIdec[k]);
+        init_fir(&v->eqQdec[k]);
+        /* at least one sample per chroma period */
+        n = sys->cc_samples >> (k + 1);
+        init_box(&v->boxdec[k], (n < 1) ? 1 : n);
+    }
+    init_fir(&v->eqY);
+    init_fir(&v->eqI);
+    init_fir(&v->eqQ);
+    init_box(&v->box, sys->cc_samples);
+    for (k = 0; k < CRT_CHROMA_DEC_MAX; k++) {
+        v->dec_off[k] = (chroma_offset(&v->eqI.fir, &v->eqIdec[k].fir,
+                                sys->cc_samples, k + 1) +
+                         chroma_offset(&v->eqQ.fir, &v->eqQdec[k].fir,
+                                sys->cc_samples, k + 1)) / 2;
+        v->boxdec_off[k] = chroma_offset(&v->box, &v->boxdec[k],
+                                sys->cc_samples, k + 1);
+    }
+    v->quality = CRT_QUALITY_DEFAULT;
+    v->chroma_dec = CRT_CHROMA_DEC;
+    return 1;
+}
+
+extern void
+crt_init(struct CRT *v, int w, int h, int f, unsigned char *out)
+{
+    crt_init_sys(v, CRT_SYSTEM, w, h, f, out);
+}
+
+extern void
+crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
+{
+    v->sys->modulate(v, s, NULL);
+}
 
+extern void
+crt_modulate_mt(struct CRT *v, struct NTSC_SETTINGS *s, struct CRT_POOL *pool)
+{
+    v->sys->modulate(v, s, pool);
 }
 
 /* search windows, in samples */
 #define HSYNC_WINDOW 6
 #define VSYNC_WINDOW 6
 
-extern void
-crt_demodulate(struct CRT *v, int noise)
+/* Noise is a hash of the sample index and the field's key, so any part
+ * of the field can be made on its own, in any order, and the loop has no
+ * dependency from one sample to the next.
+ */
+static void
+add_noise(struct CRT *v, int noise, unsigned key, int beg, int end)
 {
-    /* made static so all this data does not go on the stack */
-    static struct {
-        int y, i, q;
-    } out[AV_LEN + 1], *yiqA, *yiqB;
-    int i, j, line, rn;
+    int i, s;
+    unsigned h;
+
+    for (i = beg; i < end; i++) {
+        h = key ^ (unsigned) i;
+        h ^= h >> 16;
+        h *= 0x7feb352dU;
+        h ^= h >> 15;
+        h *= 0x846ca68bU;
+        h ^= h >> 16;
+
+        /* signal + noise */
+        s = v->analog[i] + ((((int) (h & 0xff) - 0x7f) * noise) >> 8);
+        if (s >  127) { s =  127; }
+        if (s < -127) { s = -127; }
+        v->inp[i] = s;
+    }
+}
+
+/* key of the next noisy field */
+static unsigned
+noise_key(struct CRT *v)
+{
+    unsigned key = (unsigned) v->rn;
+
+    v->rn = (int) ((214019U * key + 140327895U) & 0x7fffffffU);
+    key *= 0x9e3779b1U;
+    return key ^ (key >> 16);
+}
+
+/* Finds vsync, then tracks hsync and the color burst for every active line
+ * and stores what the line needs to be decoded in v->lines. Sync tracking
+ * depends on the previous line so this part is serial, but once it is done
+ * the lines can be decoded in any order. The noise must already be in
+ * v->sig.
+ */
+static void
+sync_pass(struct CRT *v, int noise)
+{
+    const struct CRT_SYS *sys = v->sys;
+    int hres = sys->hres;
+    int vres = sys->vres;
+    int cc = sys->cc_samples;
+    int i, j, line;
     signed char *sig;
     int s = 0;
     int field, ratio;
     int *ccr; /* color carrier signal */
     int huesn, huecs;
     int xnudge = -3, ynudge = 3;
-    int bright = v->brightness - (BLACK_LEVEL + v->black_point);
-    int bpp, pitch;
 #if CRT_DO_BLOOM
     int prev_e; /* filtered beam energy per scan line */
     int max_e; /* approx maximum energy in a scan line */
 #endif
     
-    bpp = crt_bpp4fmt(v->out_format);
-    if (bpp == 0) {
-        return;
-    }
-    pitch = v->outw * bpp;
-    
+    (void) noise;
     crt_sincos14(&huesn, &huecs, ((v->hue % 360) + 33) * 8192 / 180);
     huesn >>= 11; /* make 4-bit */
     huecs >>= 11;
 
-    rn = v->rn;
-    for (i = 0; i < CRT_INPUT_SIZE; i++) {
-        rn = (214019 * rn + 140327895);
-
-        /* signal + noise */
-        s = v->analog[i] + (((((rn >> 16) & 0xff) - 0x7f) * noise) >> 8);
-        if (s >  127) { s =  127; }
-        if (s < -127) { s = -127; }
-        v->inp[i] = s;
-    }
-    v->rn = rn;
-
     /* Look for vertical sync.
      * 
      * This is done by integrating the signal and
@@ -345,15 +584,15 @@ crt_demodulate(struct CRT *v, int noise)
      * the noise in the signal.
      */
     for (i = -VSYNC_WINDOW; i < VSYNC_WINDOW; i++) {
-        line = POSMOD(v->vsync + i, CRT_VRES);
-        sig = v->inp + line * CRT_HRES;
+        line = POSMOD(v->vsync + i, vres);
+        sig = v->sig + line * hres;
         s = 0;
-        for (j = 0; j < CRT_HRES; j++) {
+        for (j = 0; j < hres; j++) {
             s += sig[j];
             /* increase the multiplier to make the vsync
              * more stable when there is a lot of noise
              */
-            if (s <= (94 * SYNC_LEVEL)) {
+            if (s <= (94 * sys->sync_level)) {
                 goto vsync_found;
             }
         }
@@ -365,254 +604,984 @@ vsync_found:
     v->vsync = -3;
 #endif
     /* if vsync signal was in second half of line, odd field */
-    field = (j > (CRT_HRES / 2));
+    field = (j > (hres / 2));
 #if CRT_DO_BLOOM
-    max_e = (128 + (noise / 2)) * AV_LEN;
+    max_e = (128 + (noise / 2)) * sys->av_len;
     prev_e = (16384 / 8);
 #endif
     /* ratio of output height to active video lines in the signal */
-    ratio = (v->outh << 16) / CRT_LINES;
+    ratio = (v->outh << 16) / sys->lines;
     ratio = (ratio + 32768) >> 16;
     
     field = (field * (ratio / 2));
 
-    for (line = CRT_TOP; line < CRT_BOT; line++) {
+    for (line = sys->top; line < sys->bot; line++) {
+        struct CRT_LINE *cl = &v->lines[line - sys->top];
         unsigned pos, ln;
-        int scanL, scanR, dx;
-        int L, R;
-        unsigned char *cL, *cR;
-#if (CRT_CC_SAMPLES == 4)
-        int wave[CRT_CC_SAMPLES];
-#else
-        int waveI[CRT_CC_SAMPLES];
-        int waveQ[CRT_CC_SAMPLES];
-#endif
         int dci, dcq; /* decoded I, Q */
         int xpos, ypos;
-        int beg, end;
         int phasealign;
 #if CRT_DO_BLOOM
         int line_w;
 #endif
   
-        beg = (line - CRT_TOP + 0) * (v->outh + v->v_fac) / CRT_LINES + field;
-        end = (line - CRT_TOP + 1) * (v->outh + v->v_fac) / CRT_LINES + field;
+        cl->beg = (line - sys->top + 0) * (v->outh + v->v_fac) / sys->lines + field;
+        cl->end = (line - sys->top + 1) * (v->outh + v->v_fac) / sys->lines + field;
 
-        if (beg >= v->outh) { continue; }
-        if (end > v->outh) { end = v->outh; }
+        if (cl->beg >= v->outh) { continue; }
+        if (cl->end > v->outh) { cl->end = v->outh; }
 
         /* Look for horizontal sync.
          * See comment above regarding vertical sync.
          */
-        ln = (POSMOD(line + v->vsync, CRT_VRES)) * CRT_HRES;
-        sig = v->inp + ln + v->hsync;
+        ln = (POSMOD(line + v->vsync, vres)) * hres;
+        sig = v->sig + ln + v->hsync;
         s = 0;
         for (i = -HSYNC_WINDOW; i < HSYNC_WINDOW; i++) {
-            s += sig[SYNC_BEG + i];
-            if (s <= (4 * SYNC_LEVEL)) {
+            s += sig[sys->sync_beg + i];
+            if (s <= (4 * sys->sync_level)) {
                 break;
             }
         }
 #if CRT_DO_HSYNC
-        v->hsync = POSMOD(i + v->hsync, CRT_HRES);
+        v->hsync = POSMOD(i + v->hsync, hres);
 #else
         v->hsync = 0;
 #endif
         
-        xpos = POSMOD(AV_BEG + v->hsync + xnudge, CRT_HRES);
-        ypos = POSMOD(line + v->vsync + ynudge, CRT_VRES);
-        pos = xpos + ypos * CRT_HRES;
+        xpos = POSMOD(sys->av_beg + v->hsync + xnudge, hres);
+        ypos = POSMOD(line + v->vsync + ynudge, vres);
+        pos = xpos + ypos * hres;
         
-        ccr = v->ccf[ypos % CRT_CC_VPER];
-#if (CRT_CC_SAMPLES == 4)
-        sig = v->inp + ln + (v->hsync & ~3); /* faster */
-#else
-        sig = v->inp + ln + (v->hsync - (v->hsync % CRT_CC_SAMPLES));
-#endif
-        for (i = CB_BEG; i < CB_BEG + (CB_CYCLES * CRT_CB_FREQ); i++) {
+        ccr = v->ccf[ypos % sys->cc_vper];
+        sig = v->sig + ln + (v->hsync - (v->hsync % cc));
+        for (i = sys->cb_beg; i < sys->cb_beg + sys->cb_len; i++) {
             int p, n;
-            p = ccr[i % CRT_CC_SAMPLES] * 127 / 128; /* fraction of the previous */
+            p = ccr[i % cc] * 127 / 128; /* fraction of the previous */
             n = sig[i];                 /* mixed with the new sample */
-            ccr[i % CRT_CC_SAMPLES] = p + n;
+            ccr[i % cc] = p + n;
         }
 
-        phasealign = POSMOD(v->hsync, CRT_CC_SAMPLES);
+        phasealign = POSMOD(v->hsync, cc);
         
-#if (CRT_CC_SAMPLES == 4)
-        /* amplitude of carrier = saturation, phase difference = hue */
-        dci = ccr[(phasealign + 1) & 3] - ccr[(phasealign + 3) & 3];
-        dcq = ccr[(phasealign + 2) & 3] - ccr[(phasealign + 0) & 3];
-
-        wave[0] = ((dci * huecs - dcq * huesn) >> 4) * v->saturation;
-        wave[1] = ((dcq * huecs + dci * huesn) >> 4) * v->saturation;
-        wave[2] = -wave[0];
-        wave[3] = -wave[1];
-#elif (CRT_CC_SAMPLES == 5)
-        {
+        if (cc == 4) {
+            int wave[4];
+            /* amplitude of carrier = saturation, phase difference = hue */
+            dci = ccr[(phasealign + 1) & 3] - ccr[(phasealign + 3) & 3];
+            dcq = ccr[(phasealign + 2) & 3] - ccr[(phasealign + 0) & 3];
+
+            wave[0] = ((dci * huecs - dcq * huesn) >> 4) * v->saturation;
+            wave[1] = ((dcq * huecs + dci * huesn) >> 4) * v->saturation;
+            wave[2] = -wave[0];
+            wave[3] = -wave[1];
+            /* Q is demodulated with the I wave delayed by 3 samples */
+            for (i = 0; i < 4; i++) {
+                cl->waveI[i] = wave[(i + 0) & 3];
+                cl->waveQ[i] = wave[(i + 3) & 3];
+            }
+        } else {
             int dciA, dciB;
             int dcqA, dcqB;
             int ang = (v->hue % 360);
-            int off180 = CRT_CC_SAMPLES / 2;
-            int off90 = CRT_CC_SAMPLES / 4;
+            int off180 = cc / 2;
+            int off90 = cc / 4;
             int peakA = phasealign + off90;
             int peakB = phasealign + 0;
             dciA = dciB = dcqA = dcqB = 0;
             /* amplitude of carrier = saturation, phase difference = hue */
-            dciA = ccr[(peakA) % CRT_CC_SAMPLES];
+            dciA = ccr[(peakA) % cc];
             /* average */
-            dciB = (ccr[(peakA + off180) % CRT_CC_SAMPLES]
-                  + ccr[(peakA + off180 + 1) % CRT_CC_SAMPLES]) / 2;
-            dcqA = ccr[(peakB + off180) % CRT_CC_SAMPLES];
-            dcqB = ccr[(peakB) % CRT_CC_SAMPLES];
+            dciB = (ccr[(peakA + off180) % cc]
+                  + ccr[(peakA + off180 + 1) % cc]) / 2;
+            dcqA = ccr[(peakB + off180) % cc];
+            dcqB = ccr[(peakB) % cc];
             dci = dciA - dciB;
             dcq = dcqA - dcqB;
             /* create wave tables and rotate them by the hue adjustment angle */
-            for (i = 0; i < CRT_CC_SAMPLES; i++) {
+            for (i = 0; i < cc; i++) {
                 int sn, cs;
                 crt_sincos14(&sn, &cs, ang * 8192 / 180);
-                waveI[i] = ((dci * cs + dcq * sn) >> 15) * v->saturation;
+                cl->waveI[i] = ((dci * cs + dcq * sn) >> 15) * v->saturation;
                 /* Q is offset by 90 */
                 crt_sincos14(&sn, &cs, (ang + 90) * 8192 / 180);
-                waveQ[i] = ((dci * cs + dcq * sn) >> 15) * v->saturation;
-                ang += (360 / CRT_CC_SAMPLES);
+                cl->waveQ[i] = ((dci * cs + dcq * sn) >> 15) * v->saturation;
+                ang += (360 / cc);
             }
         }
-#endif
-        sig = v->inp + pos;
+        cl->pos = pos;
 #if CRT_DO_BLOOM
+        sig = v->sig + pos;
         s = 0;
-        for (i = 0; i < AV_LEN; i++) {
+        for (i = 0; i < sys->av_len; i++) {
             s += sig[i]; /* sum up the scan line */
         }
         /* bloom emulation */
         prev_e = (prev_e * 123 / 128) + ((((max_e >> 1) - s) << 10) / max_e);
-        line_w = (AV_LEN * 112 / 128) + (prev_e >> 9);
+        line_w = (sys->av_len * 112 / 128) + (prev_e >> 9);
 
-        dx = (line_w << 12) / v->outw;
-        scanL = ((AV_LEN / 2) - (line_w >> 1) + 8) << 12;
-        scanR = (AV_LEN - 1) << 12;
-        
-        L = (scanL >> 12);
-        R = (scanR >> 12);
+        cl->dx = (line_w << 12) / v->outw;
+        cl->scanL = ((sys->av_len / 2) - (line_w >> 1) + 8) << 12;
+        cl->L = (cl->scanL >> 12);
 #else
-        dx = ((AV_LEN - 1) << 12) / v->outw;
-        scanL = 0;
-        scanR = (AV_LEN - 1) << 12;
-        L = 0;
-        R = AV_LEN;
+        cl->dx = ((sys->av_len - 1) << 12) / v->outw;
+        cl->scanL = 0;
+        cl->L = 0;
 #endif
-        reset_eq(&eqY);
-        reset_eq(&eqI);
-        reset_eq(&eqQ);
+    }
+}
+
+static void
+get_output(struct CRT *v, struct CRT_OUTPUT *o)
+{
+    o->out = v->out;
+    o->outw = v->outw;
+    o->outh = v->outh;
+    o->out_format = v->out_format;
+    o->brightness = v->brightness;
+    o->contrast = v->contrast;
+    o->black_point = v->black_point;
+    o->scanlines = v->scanlines;
+    o->v_fac = v->v_fac;
+    o->quality = v->quality;
+    o->chroma_dec = v->chroma_dec;
+}
+
+static int
+same_output(const struct CRT_OUTPUT *a, const struct CRT_OUTPUT *b)
+{
+    return a->out == b->out &&
+           a->outw == b->outw &&
+           a->outh == b->outh &&
+           a->out_format == b->out_format &&
+           a->brightness == b->brightness &&
+           a->contrast == b->contrast &&
+           a->black_point == b->black_point &&
+           a->scanlines == b->scanlines &&
+           a->v_fac == b->v_fac &&
+           a->quality == b->quality &&
+           a->chroma_dec == b->chroma_dec;
+}
+
+/* a line decodes to the same rows as last time if it was tracked the same
+ * way and the analog lines it reads from have not changed
+ */
+static int
+same_line(struct CRT *v, int line)
+{
+    const struct CRT_LINE *a = &v->lines[line];
+    const struct CRT_LINE *b = &v->done[line];
+    int hres = v->sys->hres;
+    int n;
+
+    if (a->beg != b->beg || a->end != b->end || a->pos != b->pos ||
+        a->scanL != b->scanL || a->dx != b->dx || a->L != b->L) {
+        return 0;
+    }
+    for (n = 0; n < v->sys->cc_samples; n++) {
+        if (a->waveI[n] != b->waveI[n] || a->waveQ[n] != b->waveQ[n]) {
+            return 0;
+        }
+    }
+    /* the active video can run into the next line */
+    n = a->pos / hres;
+    if (v->dirty[n]) {
+        return 0;
+    }
+    n = (a->pos + v->sys->av_len) / hres;
+    return (n >= v->sys->vres) || !v->dirty[n];
+}
+
+/* decides which lines can keep their rows from the previous field */
+static void
+find_reuse(struct CRT *v, int noise)
+{
+    struct CRT_OUTPUT o;
+    int i, j, ok;
+    int lines = v->sys->lines;
+
+    get_output(v, &o);
+    ok = v->reuse && v->done_valid && !noise && !v->blend &&
+         same_output(&o, &v->done_out);
+    for (i = 0; i < lines; i++) {
+        v->lines[i].reuse = ok && same_line(v, i);
+    }
+    /* lines that land on the same rows are only kept together */
+    for (i = 0; i < lines; i = j) {
+        ok = v->lines[i].reuse;
+        for (j = i + 1; j < lines && v->lines[j].beg == v->lines[i].beg; j++) {
+            ok &= v->lines[j].reuse;
+        }
+        while (i < j) {
+            v->lines[i++].reuse = ok;
+        }
+    }
+}
+
+/* remembers what the output image shows now */
+static void
+field_done(struct CRT *v, int noise)
+{
+    memcpy(v->done, v->lines, sizeof(struct CRT_LINE) * v->sys->lines);
+    get_output(v, &v->done_out);
+    /* noisy or blended rows can't be kept */
+    v->done_valid = !noise && !v->blend;
+    memset(v->dirty, 0, sizeof(v->dirty));
+}
+
+extern void
+crt_refresh(struct CRT *v)
+{
+    v->done_valid = 0;
+}
+
+/* number of output pixels converted to RGB at a time */
+#define RGB_RUN 256
+
+/* Interpolates the demodulated line at n points (pos, pos + dx, ...),
+ * converts them to RGB and stores them as 0xRRGGBB.
+ * This is kept free of branches and away from the output buffer so the
+ * compiler is free to vectorize it.
+ *   cs  - I and Q are at 1 / 2^cs of the rate, see eq_line()
+ *   off - where they sit, see chroma_offset()
+ */
+static void
+yiq2rgb(const struct YIQ *out, unsigned pos, int dx, int n, int cs, int off,
+        int contrast, int *rgb)
+{
+    const int *oy = out->y;
+    const int *oi = out->i;
+    const int *oq = out->q;
+    unsigned p;
+    int k;
+
+    for (k = 0; k < n; k++) {
+        int y, i, q;
+        int r, g, b;
+        int L, R, s, Lc, Rc, sc, pc;
         
-#if (CRT_CC_SAMPLES == 4)
-        for (i = L; i < R; i++) {
-            out[i].y = eqf(&eqY, sig[i] + bright) << 4;
-            out[i].i = eqf(&eqI, sig[i] * wave[(i + 0) & 3] >> 9) >> 3;
-            out[i].q = eqf(&eqQ, sig[i] * wave[(i + 3) & 3] >> 9) >> 3;
+        p = pos + k * dx;
+        R = p & 0xfff;
+        L = 0xfff - R;
+        s = p >> 12;
+        pc = (int) p - off;
+        pc = ((pc < 0) ? 0 : pc) >> cs;
+        Rc = pc & 0xfff;
+        Lc = 0xfff - Rc;
+        sc = pc >> 12;
+        
+        /* interpolate between samples if needed */
+        y = ((oy[s] * L) >>  2) + ((oy[s + 1] * R) >>  2);
+        i = ((oi[sc] * Lc) >> 14) + ((oi[sc + 1] * Rc) >> 14);
+        q = ((oq[sc] * Lc) >> 14) + ((oq[sc + 1] * Rc) >> 14);
+        
+        /* YIQ to RGB */
+        r = (((y + 3879 * i + 2556 * q) >> 12) * contrast) >> 8;
+        g = (((y - 1126 * i - 2605 * q) >> 12) * contrast) >> 8;
+        b = (((y - 4530 * i + 7021 * q) >> 12) * contrast) >> 8;
+      
+        r = (r < 0) ? 0 : (r > 255) ? 255 : r;
+        g = (g < 0) ? 0 : (g > 255) ? 255 : g;
+        b = (b < 0) ? 0 : (b > 255) ? 255 : b;
+
+        rgb[k] = (r << 16 | g << 8 | b);
+    }
+}
+
+/* Generates the functions that store a run of 0xRRGGBB pixels in one
+ * output format, either as is or blended with what is already there.
+ *   r, g, b - byte offsets of the channels within a pixel
+ *   bpp     - bytes per pixel
+ */
+#define PIXEL_RUN(fmt, r, g, b, bpp)                                         \
+static void                                                                  \
+put_##fmt(unsigned char *dst, const int *rgb, int n)                         \
+{                                                                            \
+    int j;                                                                   \
+                                                                             \
+    for (j = 0; j < n; j++) {                                                \
+        dst[r] = rgb[j] >> 16 & 0xff;                                        \
+        dst[g] = rgb[j] >>  8 & 0xff;                                        \
+        dst[b] = rgb[j] >>  0 & 0xff;                                        \
+        dst += (bpp);                                                        \
+    }                                                                        \
+}                                                                            \
+static void                                                                  \
+blend_##fmt(unsigned char *dst, const int *rgb, int n)                       \
+{                                                                            \
+    int j, aa, bb;                                                           \
+                                                                             \
+    for (j = 0; j < n; j++) {                                                \
+        aa = rgb[j];                                                         \
+        bb = dst[r] << 16 | dst[g] << 8 | dst[b];                            \
+        /* blend with previous color there */                                \
+        bb = (((aa & 0xfefeff) >> 1) + ((bb & 0xfefeff) >> 1));              \
+        dst[r] = bb >> 16 & 0xff;                                            \
+        dst[g] = bb >>  8 & 0xff;                                            \
+        dst[b] = bb >>  0 & 0xff;                                            \
+        dst += (bpp);                                                        \
+    }                                                                        \
+}
+
+PIXEL_RUN(RGB,  0, 1, 2, 3)
+PIXEL_RUN(BGR,  2, 1, 0, 3)
+PIXEL_RUN(ARGB, 1, 2, 3, 4)
+PIXEL_RUN(RGBA, 0, 1, 2, 4)
+PIXEL_RUN(ABGR, 3, 2, 1, 4)
+PIXEL_RUN(BGRA, 2, 1, 0, 4)
+
+/* indexed by CRT_PIX_FORMAT_ */
+static void (*const put_fmt[])(unsigned char *, const int *, int) = {
+    put_RGB, put_BGR, put_ARGB, put_RGBA, put_ABGR, put_BGRA
+};
+static void (*const blend_fmt[])(unsigned char *, const int *, int) = {
+    blend_RGB, blend_BGR, blend_ARGB, blend_RGBA, blend_ABGR, blend_BGRA
+};
+
+/* the pixel store for the current output settings, only valid once
+ * crt_bpp4fmt() said the format exists
+ */
+#define PIXEL_FN(v) ((v)->blend ? blend_fmt : put_fmt)[(v)->out_format]
+
+/* log2 of the chroma decimation in use */
+static int
+chroma_shift(const struct CRT *v)
+{
+    if (v->chroma_dec <= 0) {
+        return 0;
+    }
+    return (v->chroma_dec > CRT_CHROMA_DEC_MAX) ? CRT_CHROMA_DEC_MAX : v->chroma_dec;
+}
+
+/* the I and Q filters for chroma at 1 / 2^cs of the rate */
+#define EQ_I(v, cs) ((cs) ? &(v)->eqIdec[(cs) - 1] : &(v)->eqI)
+#define EQ_Q(v, cs) ((cs) ? &(v)->eqQdec[(cs) - 1] : &(v)->eqQ)
+
+/* products before the line that a chroma_win() can reach */
+#define DEC_PAD ((1 << CRT_CHROMA_DEC_MAX) + CRT_MAX_CC_SAMPLES)
+
+/* Sums the demodulated I and Q of samples beg to end - 1 down to one per
+ * 2^cs samples, chroma sample g covers the chroma_win() samples that end
+ * with the last one of samples g << cs to ((g + 1) << cs) - 1.
+ *   si, sq - sums of the chroma samples beg >> cs to (end - 1) >> cs
+ */
+static void
+chroma_sums(const signed char *sig, int beg, int end,
+        const int *waveI, const int *waveQ, int cc, int cs, int *si, int *sq)
+{
+    int xi[DEC_PAD + CRT_MAX_AV_LEN + (1 << CRT_CHROMA_DEC_MAX)];
+    int xq[DEC_PAD + CRT_MAX_AV_LEN + (1 << CRT_CHROMA_DEC_MAX)];
+    int *pi = xi + DEC_PAD;
+    int *pq = xq + DEC_PAD;
+    int w = chroma_win(cc, cs);
+    int d = 1 << cs;
+    int scale = (d << 12) / w; /* a longer window is scaled down to d */
+    int i, j, k, g, ng, e;
+
+    if (end <= beg) {
+        return;
+    }
+    memset(xi, 0, sizeof(int) * DEC_PAD);
+    memset(xq, 0, sizeof(int) * DEC_PAD);
+    k = beg % cc;
+    for (i = beg; i < end; i++) {
+        pi[i - beg] = sig[i] * waveI[k] >> 9;
+        pq[i - beg] = sig[i] * waveQ[k] >> 9;
+        if (++k == cc) {
+            k = 0;
+        }
+    }
+    /* the rest of the last group is past the line */
+    ng = ((end - 1) >> cs) - (beg >> cs) + 1;
+    e = (((beg >> cs) + ng) << cs) - beg;
+    for (i = end - beg; i < e; i++) {
+        pi[i] = 0;
+        pq[i] = 0;
+    }
+    /* last sample of the first group */
+    e = ((beg >> cs) << cs) + d - 1 - beg;
+    for (g = 0; g < ng; g++) {
+        si[g] = 0;
+        sq[g] = 0;
+        for (j = 0; j < w; j++) {
+            si[g] += pi[e - j];
+            sq[g] += pq[e - j];
+        }
+        if (w != d) {
+            si[g] = si[g] * scale >> 12;
+            sq[g] = sq[g] * scale >> 12;
+        }
+        e += d;
+    }
+}
+
+/* Reduced rate chroma of samples beg to end - 1 is at beg >> cs to
+ * (end - 1) >> cs. yiq2rgb() can reach two chroma samples to either side
+ * of that, before the line there is no chroma and after it the last one
+ * holds.
+ */
+static void
+chroma_pad(struct YIQ *out, int beg, int end, int cs)
+{
+    int g, j;
+
+    if (cs == 0 || end <= beg) {
+        return;
+    }
+    for (j = 1; j <= 2; j++) {
+        g = (beg >> cs) - j;
+        if (g >= 0) {
+            out->i[g] = 0;
+            out->q[g] = 0;
+        }
+        g = (end - 1) >> cs;
+        out->i[g + j] = out->i[g];
+        out->q[g + j] = out->q[g];
+    }
+}
+
+/* eq_line() for CRT_QUALITY_FIR and CRT_QUALITY_BOX, the line is
+ * gathered into Y I Q inputs first and each is filtered in one go
+ */
+static void
+fir_yiq(struct CRT *v, const signed char *sig, int beg, int end,
+        const int *waveI, const int *waveQ, int bright, struct YIQ *out,
+        const struct EQF *eqY, const struct EQF *eqI, const struct EQF *eqQ,
+        int cs)
+{
+    /* zeros in front for the taps that reach before the line */
+    int xy[CRT_EQ_TAPS + CRT_MAX_AV_LEN + 1];
+    int xi[CRT_EQ_TAPS + CRT_MAX_AV_LEN + 1];
+    int xq[CRT_EQ_TAPS + CRT_MAX_AV_LEN + 1];
+    int *py = xy + CRT_EQ_TAPS;
+    int *pi = xi + CRT_EQ_TAPS;
+    int *pq = xq + CRT_EQ_TAPS;
+    const struct EQ_FIR *fy = &eqY->fir;
+    const struct EQ_FIR *fi = &eqI->fir;
+    const struct EQ_FIR *fq = &eqQ->fir;
+    int i, cc, g0, ng;
+
+    if (end <= beg) {
+        return;
+    }
+    if (v->quality == CRT_QUALITY_BOX) {
+        fy = fi = fq = &v->box;
+        if (cs) {
+            fi = fq = &v->boxdec[cs - 1];
+        }
+    }
+    memset(xy, 0, sizeof(int) * CRT_EQ_TAPS);
+    memset(xi, 0, sizeof(int) * CRT_EQ_TAPS);
+    memset(xq, 0, sizeof(int) * CRT_EQ_TAPS);
+    cc = v->sys->cc_samples;
+    if (cs) {
+        for (i = beg; i < end; i++) {
+            py[i - beg] = sig[i] + bright;
+        }
+        chroma_sums(sig, beg, end, waveI, waveQ, cc, cs, pi, pq);
+    } else if (cc == 4) {
+        for (i = beg; i < end; i++) {
+            py[i - beg] = sig[i] + bright;
+            pi[i - beg] = sig[i] * waveI[i & 3] >> 9;
+            pq[i - beg] = sig[i] * waveQ[i & 3] >> 9;
+        }
+    } else {
+        for (i = beg; i < end; i++) {
+            py[i - beg] = sig[i] + bright;
+            pi[i - beg] = sig[i] * waveI[i % cc] >> 9;
+            pq[i - beg] = sig[i] * waveQ[i % cc] >> 9;
+        }
+    }
+    g0 = beg >> cs;
+    ng = ((end - 1) >> cs) - g0 + 1;
+    fir_line(fy, py, end - beg, out->y + beg);
+    fir_line(fi, pi, ng, out->i + g0);
+    fir_line(fq, pq, ng, out->q + g0);
+    for (i = beg; i < end; i++) {
+        out->y[i] <<= 4;
+    }
+    for (i = g0; i < g0 + ng; i++) {
+        out->i[i] >>= 3 + cs;
+        out->q[i] >>= 3 + cs;
+    }
+    chroma_pad(out, beg, end, cs);
+}
+
+/* eq_line() with the EQ for reduced rate chroma, each chroma_sums() sum
+ * goes through eqI and eqQ once
+ */
+static void
+eq_line_dec(struct CRT *v, const signed char *sig, int beg, int end,
+        const int *waveI, const int *waveQ, int bright, struct YIQ *out,
+        struct EQF *eqY, struct EQF *eqI, struct EQF *eqQ, int cs)
+{
+    int si[CRT_MAX_DEC_LEN], sq[CRT_MAX_DEC_LEN];
+    int i, g, g0, ng;
+
+    if (end <= beg) {
+        return;
+    }
+    reset_eq(eqY);
+    reset_eq(eqI);
+    reset_eq(eqQ);
+    for (i = beg; i < end; i++) {
+        out->y[i] = eqf(eqY, sig[i] + bright) << 4;
+    }
+    chroma_sums(sig, beg, end, waveI, waveQ, v->sys->cc_samples, cs, si, sq);
+    g0 = beg >> cs;
+    ng = ((end - 1) >> cs) - g0 + 1;
+    for (g = 0; g < ng; g++) {
+        out->i[g0 + g] = eqf(eqI, si[g]) >> (3 + cs);
+        out->q[g0 + g] = eqf(eqQ, sq[g]) >> (3 + cs);
+    }
+    chroma_pad(out, beg, end, cs);
+}
+
+/* runs samples beg to end - 1 of a line through the filters
+ *   sig           - the line's signal
+ *   waveI, waveQ  - color carrier, see struct CRT_LINE
+ *   bright        - added to the signal for luma
+ *   out           - decoded line
+ *   eqY, eqI, eqQ - filters used for this line, they get reset first
+ *   cs            - chroma_shift(), I and Q of sample i end up at i >> cs
+ *                   and eqI, eqQ have to be the ones for that rate
+ */
+static void
+eq_line(struct CRT *v, const signed char *sig, int beg, int end,
+        const int *waveI, const int *waveQ, int bright, struct YIQ *out,
+        struct EQF *eqY, struct EQF *eqI, struct EQF *eqQ, int cs)
+{
+    int i, cc;
+
+    if (v->quality == CRT_QUALITY_FIR || v->quality == CRT_QUALITY_BOX) {
+        fir_yiq(v, sig, beg, end, waveI, waveQ, bright, out, eqY, eqI, eqQ, cs);
+        return;
+    }
+    if (cs) {
+        eq_line_dec(v, sig, beg, end, waveI, waveQ, bright, out,
+                eqY, eqI, eqQ, cs);
+        return;
+    }
+    reset_eq(eqY);
+    reset_eq(eqI);
+    reset_eq(eqQ);
+    
+    if (v->sys->cc_samples == 4) {
+        for (i = beg; i < end; i++) {
+            out->y[i] = eqf(eqY, sig[i] + bright) << 4;
+            out->i[i] = eqf(eqI, sig[i] * waveI[i & 3] >> 9) >> 3;
+            out->q[i] = eqf(eqQ, sig[i] * waveQ[i & 3] >> 9) >> 3;
+        }
+    } else {
+        cc = v->sys->cc_samples;
+        for (i = beg; i < end; i++) {
+            out->y[i] = eqf(eqY, sig[i] + bright) << 4;
+            out->i[i] = eqf(eqI, sig[i] * waveI[i % cc] >> 9) >> 3;
+            out->q[i] = eqf(eqQ, sig[i] * waveQ[i % cc] >> 9) >> 3;
+        }
+    }
+}
+
+#if EQ_LANES
+/* the reduced rate chroma of eq_lines(), every line's chroma_sums() go
+ * through the filters side by side
+ *   sig - signal of each lane, the unused ones repeat a line
+ *   sc  - the decoded lines, and room for the sums
+ */
+static void
+eq_lanes_dec(struct CRT *v, const signed char *const *sig, int beg, int end,
+        const struct CRT_LINE *const *cl, struct CRT_SCRATCH *sc, int n,
+        const struct EQF *eqI, const struct EQF *eqQ, int cs)
+{
+    struct EQL si, sq;
+    struct YIQ *out = sc->yiq;
+    int li[CRT_EQ_LANES], lq[CRT_EQ_LANES];
+    int g, g0, ng, l;
+
+    if (end <= beg) {
+        return;
+    }
+    memset(&si, 0, sizeof(si));
+    memset(&sq, 0, sizeof(sq));
+    for (l = 0; l < CRT_EQ_LANES; l++) {
+        const struct CRT_LINE *c = cl[(l < n) ? l : 0];
+        chroma_sums(sig[l], beg, end, c->waveI, c->waveQ,
+                v->sys->cc_samples, cs, sc->ci[l], sc->cq[l]);
+    }
+    g0 = beg >> cs;
+    ng = ((end - 1) >> cs) - g0 + 1;
+    for (g = 0; g < ng; g++) {
+        for (l = 0; l < CRT_EQ_LANES; l++) {
+            li[l] = sc->ci[l][g];
+            lq[l] = sc->cq[l][g];
+        }
+        eqf_lanes(eqI, &si, li);
+        eqf_lanes(eqQ, &sq, lq);
+        for (l = 0; l < n; l++) {
+            out[l].i[g0 + g] = li[l] >> (3 + cs);
+            out[l].q[g0 + g] = lq[l] >> (3 + cs);
+        }
+    }
+    for (l = 0; l < n; l++) {
+        chroma_pad(&out[l], beg, end, cs);
+    }
+}
+
+/* eq_line() for up to CRT_EQ_LANES lines at once, one line per lane.
+ * The lines are read and written across the lanes a sample at a time.
+ *   sig - signal of each line
+ *   cl  - the lines, for their color carrier
+ *   sc  - the decoded lines end up in sc->yiq
+ *   n   - number of lines
+ */
+static void
+eq_lines(struct CRT *v, const signed char *const *sig, int beg, int end,
+        const struct CRT_LINE *const *cl, int bright, struct CRT_SCRATCH *sc,
+        int n, const struct EQF *eqY, const struct EQF *eqI,
+        const struct EQF *eqQ, int cs)
+{
+    struct EQL sy, si, sq;
+    struct YIQ *out = sc->yiq;
+    int wI[CRT_MAX_CC_SAMPLES][CRT_EQ_LANES];
+    int wQ[CRT_MAX_CC_SAMPLES][CRT_EQ_LANES];
+    int ly[CRT_EQ_LANES], li[CRT_EQ_LANES], lq[CRT_EQ_LANES];
+    const signed char *ls[CRT_EQ_LANES];
+    int i, k, l, cc;
+
+    memset(&sy, 0, sizeof(sy));
+    memset(&si, 0, sizeof(si));
+    memset(&sq, 0, sizeof(sq));
+    cc = v->sys->cc_samples;
+    /* unused lanes just decode the first line again */
+    for (l = 0; l < CRT_EQ_LANES; l++) {
+        ls[l] = sig[(l < n) ? l : 0];
+        for (k = 0; k < cc; k++) {
+            wI[k][l] = cl[(l < n) ? l : 0]->waveI[k];
+            wQ[k][l] = cl[(l < n) ? l : 0]->waveQ[k];
         }
+    }
+    if (cs) {
+        eq_lanes_dec(v, ls, beg, end, cl, sc, n, eqI, eqQ, cs);
+        for (i = beg; i < end; i++) {
+            for (l = 0; l < CRT_EQ_LANES; l++) {
+                ly[l] = ls[l][i] + bright;
+            }
+            eqf_lanes(eqY, &sy, ly);
+            for (l = 0; l < n; l++) {
+                out[l].y[i] = ly[l] << 4;
+            }
+        }
+        return;
+    }
+    k = beg % cc;
+    for (i = beg; i < end; i++) {
+        for (l = 0; l < CRT_EQ_LANES; l++) {
+            int s = ls[l][i];
+            ly[l] = s + bright;
+            li[l] = s * wI[k][l] >> 9;
+            lq[l] = s * wQ[k][l] >> 9;
+        }
+        eqf_lanes(eqY, &sy, ly);
+        eqf_lanes(eqI, &si, li);
+        eqf_lanes(eqQ, &sq, lq);
+        for (l = 0; l < n; l++) {
+            out[l].y[i] = ly[l] << 4;
+            out[l].i[i] = li[l] >> 3;
+            out[l].q[i] = lq[l] >> 3;
+        }
+        if (++k == cc) {
+            k = 0;
+        }
+    }
+}
+#endif
+
+/* scans a decoded line onto its rows of the output image
+ *   put - PIXEL_FN() of the output
+ *   cs  - rate of the line's chroma, see eq_line()
+ */
+static void
+put_line(struct CRT *v, const struct CRT_LINE *cl, const struct YIQ *out,
+        void (*put)(unsigned char *, const int *, int), int cs)
+{
+    int rgb[RGB_RUN];
+    unsigned pos;
+    int k, m, n, s;
+    int scanR = (v->sys->av_len - 1) << 12;
+    unsigned char *cL;
+    int bpp, pitch, off;
+
+    bpp = crt_bpp4fmt(v->out_format);
+    pitch = v->outw * bpp;
+
+    /* number of output pixels, same as stepping until pos reaches scanR */
+    n = 0;
+    pos = cl->scanL;
+    if (cl->dx > 0) {
+        if (pos < (unsigned) scanR) {
+            n = ((unsigned) scanR - pos + cl->dx - 1) / cl->dx;
+        }
+        if (n > v->outw) {
+            n = v->outw;
+        }
+    } else {
+        for (; pos < (unsigned) scanR && n < v->outw; pos += cl->dx) {
+            n++;
+        }
+    }
+
+    cL = v->out + (cl->beg * pitch);
+    off = 0;
+    if (cs) {
+        off = (v->quality == CRT_QUALITY_BOX) ?
+                v->boxdec_off[cs - 1] : v->dec_off[cs - 1];
+    }
+
+    for (k = 0; k < n; k += RGB_RUN) {
+        m = n - k;
+        if (m > RGB_RUN) {
+            m = RGB_RUN;
+        }
+        yiq2rgb(out, cl->scanL + k * cl->dx, cl->dx, m, cs, off, v->contrast, rgb);
+        put(cL, rgb, m);
+        cL += m * bpp;
+    }
+    
+    /* duplicate extra lines */
+    for (s = cl->beg + 1; s < (cl->end - v->scanlines); s++) {
+        memcpy(v->out + s * pitch, v->out + (s - 1) * pitch, pitch);
+    }
+}
+
+/* the end of the part of a line that gets decoded */
+#if CRT_DO_BLOOM
+#define LINE_END(v) ((v)->sys->av_len - 1)
 #else
-        for (i = L; i < R; i++) {
-            out[i].y = eqf(&eqY, sig[i] + bright) << 4;
-            out[i].i = eqf(&eqI, sig[i] * waveI[i % CRT_CC_SAMPLES] >> 9) >> 3;
-            out[i].q = eqf(&eqQ, sig[i] * waveQ[i % CRT_CC_SAMPLES] >> 9) >> 3;
-        } 
+#define LINE_END(v) ((v)->sys->av_len)
 #endif
 
-        cL = v->out + (beg * pitch);
-        cR = cL + pitch;
-
-        for (pos = scanL; pos < scanR && cL < cR; pos += dx) {
-            int y, i, q;
-            int r, g, b;
-            int aa, bb;
-
-            R = pos & 0xfff;
-            L = 0xfff - R;
-            s = pos >> 12;
-            
-            yiqA = out + s;
-            yiqB = out + s + 1;
-            
-            /* interpolate between samples if needed */
-            y = ((yiqA->y * L) >>  2) + ((yiqB->y * R) >>  2);
-            i = ((yiqA->i * L) >> 14) + ((yiqB->i * R) >> 14);
-            q = ((yiqA->q * L) >> 14) + ((yiqB->q * R) >> 14);
-            
-            /* YIQ to RGB */
-            r = (((y + 3879 * i + 2556 * q) >> 12) * v->contrast) >> 8;
-            g = (((y - 1126 * i - 2605 * q) >> 12) * v->contrast) >> 8;
-            b = (((y - 4530 * i + 7021 * q) >> 12) * v->contrast) >> 8;
-          
-            if (r < 0) r = 0;
-            if (g < 0) g = 0;
-            if (b < 0) b = 0;
-            if (r > 255) r = 255;
-            if (g > 255) g = 255;
-            if (b > 255) b = 255;
-
-            if (v->blend) {
-                aa = (r << 16 | g << 8 | b);
-
-                switch (v->out_format) {
-                    case CRT_PIX_FORMAT_RGB:
-                    case CRT_PIX_FORMAT_RGBA:
-                        bb = cL[0] << 16 | cL[1] << 8 | cL[2];
-                        break;
-                    case CRT_PIX_FORMAT_BGR: 
-                    case CRT_PIX_FORMAT_BGRA:
-                        bb = cL[2] << 16 | cL[1] << 8 | cL[0];
-                        break;
-                    case CRT_PIX_FORMAT_ARGB:
-                        bb = cL[1] << 16 | cL[2] << 8 | cL[3];
-                        break;
-                    case CRT_PIX_FORMAT_ABGR:
-                        bb = cL[3] << 16 | cL[2] << 8 | cL[1];
-                        break;
-                    default:
-                        bb = 0;
-                        break;
-                }
-
-                /* blend with previous color there */
-                bb = (((aa & 0xfefeff) >> 1) + ((bb & 0xfefeff) >> 1));
-            } else {
-                bb = (r << 16 | g << 8 | b);
-            }
+/* decodes a line that was prepared by sync_pass() into the output image
+ *   out           - scratch line
+ *   eqY, eqI, eqQ - filters used for this line, they get reset first
+ *   put           - PIXEL_FN() of the output
+ *   cs            - chroma_shift() the filters are for
+ */
+static void
+demod_line(struct CRT *v, struct CRT_LINE *cl, struct YIQ *out,
+        struct EQF *eqY, struct EQF *eqI, struct EQF *eqQ,
+        void (*put)(unsigned char *, const int *, int), int cs)
+{
+    int bright = v->brightness - (v->sys->black_level + v->black_point);
+
+    if (cl->beg >= v->outh || cl->reuse) {
+        return;
+    }
+    eq_line(v, v->sig + cl->pos, cl->L, LINE_END(v),
+            cl->waveI, cl->waveQ, bright, out, eqY, eqI, eqQ, cs);
+    put_line(v, cl, out, put, cs);
+}
+
+#if EQ_LANES
+/* demod_lines() with the EQ, as many lines at a time as there are lanes */
+static void
+demod_lanes(struct CRT *v, int first, int last, struct CRT_SCRATCH *sc,
+        struct EQF *eqY, struct EQF *eqI, struct EQF *eqQ,
+        void (*put)(unsigned char *, const int *, int), int cs)
+{
+    const signed char *sig[CRT_EQ_LANES];
+    const struct CRT_LINE *cl[CRT_EQ_LANES];
+    int bright = v->brightness - (v->sys->black_level + v->black_point);
+    int line, n, i;
 
-            switch (v->out_format) {
-                case CRT_PIX_FORMAT_RGB:
-                case CRT_PIX_FORMAT_RGBA:
-                    cL[0] = bb >> 16 & 0xff;
-                    cL[1] = bb >>  8 & 0xff;
-                    cL[2] = bb >>  0 & 0xff;
-                    break;
-                case CRT_PIX_FORMAT_BGR: 
-                case CRT_PIX_FORMAT_BGRA:
-                    cL[0] = bb >>  0 & 0xff;
-                    cL[1] = bb >>  8 & 0xff;
-                    cL[2] = bb >> 16 & 0xff;
-                    break;
-                case CRT_PIX_FORMAT_ARGB:
-                    cL[1] = bb >> 16 & 0xff;
-                    cL[2] = bb >>  8 & 0xff;
-                    cL[3] = bb >>  0 & 0xff;
-                    break;
-                case CRT_PIX_FORMAT_ABGR:
-                    cL[1] = bb >>  0 & 0xff;
-                    cL[2] = bb >>  8 & 0xff;
-                    cL[3] = bb >> 16 & 0xff;
-                    break;
-                default:
-                    break;
+    line = first;
+    while (line < last) {
+        /* the next lines that need decoding and start at the same sample */
+        n = 0;
+        for (; line < last && n < CRT_EQ_LANES; line++) {
+            struct CRT_LINE *c = &v->lines[line];
+            if (c->beg >= v->outh || c->reuse) {
+                continue;
             }
+            if (n > 0 && c->L != cl[0]->L) {
+                break;
+            }
+            cl[n] = c;
+            sig[n] = v->sig + c->pos;
+            n++;
+        }
+        if (n == 0) {
+            break;
+        }
+        eq_lines(v, sig, cl[0]->L, LINE_END(v), cl, bright, sc, n,
+                eqY, eqI, eqQ, cs);
+        /* in order, lines can share output rows */
+        for (i = 0; i < n; i++) {
+            put_line(v, cl[i], &sc->yiq[i], put, cs);
+        }
+    }
+}
+#endif
 
-            cL += bpp;
+/* decodes lines first to last - 1
+ *   sc - where the lines are decoded, one per thread
+ *   cs - chroma_shift() the filters are for
+ */
+static void
+demod_lines(struct CRT *v, int first, int last, struct CRT_SCRATCH *sc,
+        struct EQF *eqY, struct EQF *eqI, struct EQF *eqQ,
+        void (*put)(unsigned char *, const int *, int), int cs)
+{
+    int line;
+
+#if EQ_LANES
+    if (v->quality == CRT_QUALITY_EQ) {
+        demod_lanes(v, first, last, sc, eqY, eqI, eqQ, put, cs);
+        return;
+    }
+#endif
+    for (line = first; line < last; line++) {
+        demod_line(v, &v->lines[line], sc->yiq, eqY, eqI, eqQ, put, cs);
+    }
+}
+
+extern void
+crt_eq_line(struct CRT *v, const signed char *sig, int beg, int end,
+        const int *waveI, const int *waveQ, int bright, struct YIQ *out)
+{
+    eq_line(v, sig, beg, end, waveI, waveQ, bright, out,
+            &v->eqY, &v->eqI, &v->eqQ, 0);
+}
+
+extern void
+crt_put_line(struct CRT *v, const struct CRT_LINE *cl, const struct YIQ *yiq)
+{
+    if (cl->beg >= v->outh || crt_bpp4fmt(v->out_format) == 0) {
+        return;
+    }
+    put_line(v, cl, yiq, PIXEL_FN(v), 0);
+}
+
+extern void
+crt_demodulate(struct CRT *v, int noise)
+{
+    int cs = chroma_shift(v);
+
+    if (crt_bpp4fmt(v->out_format) == 0) {
+        return;
+    }
+    v->sig = v->analog;
+    if (noise) {
+        add_noise(v, noise, noise_key(v), 0, v->sys->hres * v->sys->vres);
+        v->sig = v->inp;
+    }
+    sync_pass(v, noise);
+    find_reuse(v, noise);
+    demod_lines(v, 0, v->sys->lines, &v->scratch, &v->eqY,
+            EQ_I(v, cs), EQ_Q(v, cs), PIXEL_FN(v), cs);
+    field_done(v, noise);
+}
+
+struct DEMOD_JOB {
+    struct CRT *v;
+    struct CRT_POOL *pool; /* for the scratch of the other workers */
+    void (*put)(unsigned char *, const int *, int);
+    int band[CRT_POOL_MAX * CRT_POOL_BANDS + 1]; /* first line of each band */
+};
+
+static void
+demod_band(void *ctx, int job, int worker)
+{
+    struct DEMOD_JOB *dj = ctx;
+    struct CRT *v = dj->v;
+    struct CRT_SCRATCH *sc = &v->scratch;
+    struct EQF eqY, eqI, eqQ;
+    int cs = chroma_shift(v);
+
+    /* worker 0 is the calling thread, the others' were allocated before */
+    if (worker != 0) {
+        sc = crt_pool_scratch(dj->pool, worker, sizeof(struct CRT_SCRATCH));
+    }
+    eqY = v->eqY;
+    eqI = *EQ_I(v, cs);
+    eqQ = *EQ_Q(v, cs);
+    demod_lines(v, dj->band[job], dj->band[job + 1], sc,
+            &eqY, &eqI, &eqQ, dj->put, cs);
+}
+
+struct NOISE_JOB {
+    struct CRT *v;
+    int noise;
+    unsigned key;
+    int n; /* number of bands */
+};
+
+static void
+noise_band(void *ctx, int job, int worker)
+{
+    struct NOISE_JOB *nj = ctx;
+    int size = nj->v->sys->hres * nj->v->sys->vres;
+
+    (void) worker;
+    add_noise(nj->v, nj->noise, nj->key,
+            job * size / nj->n, (job + 1) * size / nj->n);
+}
+
+extern void
+crt_demodulate_mt(struct CRT *v, int noise, struct CRT_POOL *pool)
+{
+    struct DEMOD_JOB dj;
+    struct NOISE_JOB nj;
+    int i, n, line, prev;
+    int lines = v->sys->lines;
+
+    n = crt_pool_size(pool) * CRT_POOL_BANDS;
+    for (i = 1; i < crt_pool_size(pool); i++) {
+        if (crt_pool_scratch(pool, i, sizeof(struct CRT_SCRATCH)) == NULL) {
+            n = 0; /* out of memory, decode it on this thread */
         }
-        
-        /* duplicate extra lines */
-        for (s = beg + 1; s < (end - v->scanlines); s++) {
-            memcpy(v->out + s * pitch, v->out + (s - 1) * pitch, pitch);
+    }
+    if (n <= CRT_POOL_BANDS) {
+        crt_demodulate(v, noise);
+        return;
+    }
+    if (crt_bpp4fmt(v->out_format) == 0) {
+        return;
+    }
+    v->sig = v->analog;
+    if (noise) {
+        nj.v = v;
+        nj.noise = noise;
+        nj.key = noise_key(v);
+        nj.n = n;
+        crt_pool_run(pool, noise_band, &nj, n);
+        v->sig = v->inp;
+    }
+    sync_pass(v, noise);
+    find_reuse(v, noise);
+    if (n > lines) {
+        n = lines;
+    }
+    dj.v = v;
+    dj.pool = pool;
+    dj.put = PIXEL_FN(v);
+    /* when the output is shorter than the signal, neighboring lines can
+     * land on the same output row. Those need to stay in one band and in
+     * order so the result matches crt_demodulate() exactly.
+     */
+    prev = 0;
+    dj.band[0] = 0;
+    for (i = 1; i < n; i++) {
+        line = i * lines / n;
+        if (line < prev) {
+            line = prev;
+        }
+        while (line > 0 && line < lines &&
+               v->lines[line].beg == v->lines[line - 1].beg) {
+            line++;
         }
+        dj.band[i] = line;
+        prev = line;
     }
+    dj.band[n] = lines;
+    crt_pool_run(pool, demod_band, &dj, n);
+    field_done(v, noise);
 }
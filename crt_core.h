@@ -30,9 +30,21 @@ extern "C" {
 #define CRT_SYSTEM_NTSC 0 /* standard NTSC */
 #define CRT_SYSTEM_NES  1 /* decode 6 or 9-bit NES pixels */
 #define CRT_SYSTEM_PV1K 2 /* Casio PV-1000 */
+#define CRT_NUM_SYSTEMS 3
 
-/* the system to be compiled */
+/* I and Q can be made (NTSC modulator) and filtered (demodulator) at up to
+ * 1 / 2^CRT_CHROMA_DEC_MAX of the sample rate, see CRT_CHROMA_DEC
+ */
+#define CRT_CHROMA_DEC_MAX 2
+
+/* the system crt_init() sets up and whose NTSC_SETTINGS are included below.
+ * Every system is compiled into the library and can be picked at runtime
+ * with crt_init_sys(). A source file can define CRT_SYSTEM before including
+ * this header to get the NTSC_SETTINGS of another system.
+ */
+#ifndef CRT_SYSTEM
 #define CRT_SYSTEM CRT_SYSTEM_NTSC
+#endif
 
 #if (CRT_SYSTEM == CRT_SYSTEM_NES)
 #include "crt_nes.h"
@@ -44,6 +56,26 @@ extern "C" {
 #error No system defined
 #endif
 
+/* largest signal of all the systems, so struct CRT is the same no matter
+ * which system an instance emulates. That makes it about 1.2 MB (two
+ * PV-1000 sized fields and the demodulator's struct CRT_SCRATCH), more
+ * than the default stack of some platforms (1 MB on Windows), so make
+ * instances static or allocate them.
+ */
+#define CRT_MAX_HRES        1920 /* PV-1000 */
+#define CRT_MAX_VRES        262
+#define CRT_MAX_INPUT_SIZE  (CRT_MAX_HRES * CRT_MAX_VRES)
+#define CRT_MAX_LINES       240
+#define CRT_MAX_AV_LEN      1487 /* PV-1000 */
+#define CRT_MAX_CC_SAMPLES  5
+#define CRT_MAX_CC_VPER     5
+
+#if (CRT_HRES > CRT_MAX_HRES) || (CRT_VRES > CRT_MAX_VRES) || \
+    (CRT_LINES > CRT_MAX_LINES) || (AV_LEN > CRT_MAX_AV_LEN) || \
+    (CRT_CC_SAMPLES > CRT_MAX_CC_SAMPLES) || (CRT_CC_VPER > CRT_MAX_CC_VPER)
+#error The CRT_MAX_ sizes are too small for this system
+#endif
+
 /* NOTE: this library does not use the alpha channel at all */
 #define CRT_PIX_FORMAT_RGB  0  /* 3 bytes per pixel [R,G,B,R,G,B,R,G,B...] */
 #define CRT_PIX_FORMAT_BGR  1  /* 3 bytes per pixel [B,G,R,B,G,R,B,G,R...] */
@@ -57,9 +89,152 @@ extern "C" {
 #define CRT_DO_VSYNC    1  /* look for VSYNC */
 #define CRT_DO_HSYNC    1  /* look for HSYNC */
 
+/* The demodulator filters are picked at run time with v->quality:
+ *   CRT_QUALITY_EQ  - 3 band EQ, softer, more authentic and more analog
+ *   CRT_QUALITY_FIR - FIR filter made from the EQ's impulse response at
+ *                     init, it filters a whole line at once along the time
+ *                     axis which vectorizes. Only differs from the EQ by
+ *                     rounding (see README)
+ *   CRT_QUALITY_BOX - short convolution, an average over one chroma period
+ *                     smoothed by the kernel below. The cheapest
+ * The defines below only choose the default.
+ */
+#define CRT_QUALITY_EQ  0
+#define CRT_QUALITY_FIR 1
+#define CRT_QUALITY_BOX 2
+
+/* convolution is much faster but the EQ looks softer, more authentic, and more analog */
+#define USE_CONVOLUTION 0
+#define USE_7_SAMPLE_KERNEL 1
+#define USE_6_SAMPLE_KERNEL 0
+#define USE_5_SAMPLE_KERNEL 0
+/* NOTE: the kernel sizes are for 4 samples per chroma period,
+ * systems with 5 get a kernel that is one sample longer
+ */
+
+#define CRT_EQ_FIR  0 /* 1 = CRT_QUALITY_FIR by default */
+#define CRT_EQ_TAPS 24 /* longest FIR (multiple of 4), the rest is dropped */
+
+#if USE_CONVOLUTION
+#define CRT_QUALITY_DEFAULT CRT_QUALITY_BOX
+#elif CRT_EQ_FIR
+#define CRT_QUALITY_DEFAULT CRT_QUALITY_FIR
+#else
+#define CRT_QUALITY_DEFAULT CRT_QUALITY_EQ
+#endif
+
+/* number of scan lines that are run through the EQ side by side so the
+ * compiler can put them in the lanes of vector registers, 1 = one at a time.
+ * The output is the same either way. Only used by CRT_QUALITY_EQ.
+ */
+#define CRT_EQ_LANES 8
+
+/* v->chroma_dec, the demodulated I and Q are summed over 2^chroma_dec
+ * samples and filtered at that reduced rate, which is plenty for their
+ * bandwidth. 0 = full rate, up to CRT_CHROMA_DEC_MAX (4 times fewer).
+ */
+#define CRT_CHROMA_DEC     0 /* default */
+
+#define HISTLEN     3
+#define HISTOLD     (HISTLEN - 1) /* oldest entry */
+#define HISTNEW     0             /* newest entry */
+
+/* FIR filter, see CRT_QUALITY_FIR and CRT_QUALITY_BOX */
+struct EQ_FIR {
+    int taps[CRT_EQ_TAPS];
+    int ntaps; /* a multiple of 4 */
+    int round; /* added before the final shift */
+};
+
+/* three band equalizer */
+struct EQF {
+    int lf, hf; /* fractions */
+    int g[3]; /* gains */
+    int fL[4];
+    int fH[4];
+    int h[HISTLEN]; /* history */
+    struct EQ_FIR fir; /* impulse response */
+};
+
+/* demodulated scan line, kept planar so it can be resampled with vector loads */
+struct YIQ {
+    int y[CRT_MAX_AV_LEN + 1];
+    int i[CRT_MAX_AV_LEN + 1];
+    int q[CRT_MAX_AV_LEN + 1];
+};
+
+/* room for the chroma of a line at half the rate or less */
+#define CRT_MAX_DEC_LEN ((CRT_MAX_AV_LEN >> 1) + 3)
+
+/* the lines one thread of the demodulator decodes side by side, too big
+ * for the stack of a thread. crt_demodulate() uses the one in the CRT.
+ */
+struct CRT_SCRATCH {
+    struct YIQ yiq[CRT_EQ_LANES]; /* scan lines being demodulated */
+    /* their I and Q summed down to the reduced chroma rate */
+    int ci[CRT_EQ_LANES][CRT_MAX_DEC_LEN];
+    int cq[CRT_EQ_LANES][CRT_MAX_DEC_LEN];
+};
+
+/* what the demodulator needs to know about an active line once its sync
+ * and color burst have been tracked
+ */
+struct CRT_LINE {
+    int beg, end; /* range of output rows */
+    int pos; /* offset of the active video in the signal */
+    int waveI[CRT_MAX_CC_SAMPLES]; /* I and Q demodulation waves */
+    int waveQ[CRT_MAX_CC_SAMPLES];
+    int scanL, dx, L; /* horizontal scan start and step */
+    int reuse; /* the rows from the previous field are still right */
+};
+
+/* output settings the decoded rows of a field depend on, see v->reuse */
+struct CRT_OUTPUT {
+    unsigned char *out;
+    int outw, outh, out_format;
+    int brightness, contrast, black_point;
+    int scanlines;
+    unsigned v_fac;
+    int quality;
+    int chroma_dec;
+};
+
+struct CRT;
+struct CRT_POOL; /* see crt_pool.h */
+
+/* timings and entry points of an emulated system */
+struct CRT_SYS {
+    int id; /* one of the CRT_SYSTEMs */
+    const char *name;
+    int hres, vres; /* samples per line, lines per field */
+    int top, bot; /* first and final line with active video */
+    int lines; /* number of active video lines */
+    int av_beg, av_len; /* active video */
+    int sync_beg; /* start of the hsync pulse */
+    int cb_beg, cb_len; /* color burst */
+    int cc_samples; /* samples per chroma period */
+    int cc_vper; /* vertical period in which the artifacts repeat */
+    int l_freq; /* full line frequency */
+    int black_level, sync_level; /* IRE */
+    /* the system's crt_modulate_mt(),
+     * s must point to the NTSC_SETTINGS of this system
+     */
+    void (*modulate)(struct CRT *v, struct NTSC_SETTINGS *s,
+            struct CRT_POOL *pool);
+};
+
+extern const struct CRT_SYS crt_sys_ntsc;
+extern const struct CRT_SYS crt_sys_nes;
+extern const struct CRT_SYS crt_sys_pv1k;
+
+/* about 1.2 MB, see CRT_MAX_HRES */
 struct CRT {
-    signed char analog[CRT_INPUT_SIZE];
-    signed char inp[CRT_INPUT_SIZE]; /* CRT input, can be noisy */
+    /* the analog signal, v->sys->hres * v->sys->vres samples. It is in
+     * analog_buf unless a crt_stream lent the CRT one of its buffers.
+     */
+    signed char *analog;
+    signed char analog_buf[CRT_MAX_INPUT_SIZE];
+    signed char inp[CRT_MAX_INPUT_SIZE]; /* CRT input, analog + noise */
 
     int outw, outh; /* output width/height */
     int out_format; /* output pixel format (one of the CRT_PIX_FORMATs) */
@@ -70,14 +245,47 @@ struct CRT {
     int scanlines; /* leave gaps between lines if necessary */
     int blend; /* blend new field onto previous image */
     unsigned v_fac; /* factor to stretch img vertically onto the output img */
+    int reuse; /* 1 = keep the rows of lines that didn't change, see below */
+    int quality; /* demodulator filters, one of the CRT_QUALITYs */
+    int chroma_dec; /* I and Q at 1 / 2^chroma_dec of the rate, see CRT_CHROMA_DEC */
 
     /* internal data */
-    int ccf[CRT_CC_VPER][CRT_CC_SAMPLES]; /* faster color carrier convergence */
+    const struct CRT_SYS *sys; /* system being emulated */
+    int ccf[CRT_MAX_CC_VPER][CRT_MAX_CC_SAMPLES]; /* faster color carrier convergence */
     int hsync, vsync; /* keep track of sync over frames */
-    int rn; /* seed for the 'random' noise */
+    int rn; /* seed for the 'random' noise, changes every noisy field */
+    signed char *sig; /* signal being decoded, inp or analog if no noise */
+    struct EQF eqY, eqI, eqQ; /* demodulator filters */
+    struct EQ_FIR box; /* CRT_QUALITY_BOX, the same for Y, I and Q */
+    /* eqI, eqQ and box at the reduced chroma rates */
+    struct EQF eqIdec[CRT_CHROMA_DEC_MAX], eqQdec[CRT_CHROMA_DEC_MAX];
+    struct EQ_FIR boxdec[CRT_CHROMA_DEC_MAX];
+    /* where their chroma sits, in 1/4096 samples past the start of a group */
+    int dec_off[CRT_CHROMA_DEC_MAX], boxdec_off[CRT_CHROMA_DEC_MAX];
+    struct CRT_SCRATCH scratch; /* lines being demodulated */
+    struct CRT_LINE lines[CRT_MAX_LINES];
+    /* analog lines that changed since the last demodulation,
+     * set by the modulators
+     */
+    unsigned char dirty[CRT_MAX_VRES];
+    /* NTSC_SETTINGS whose sync, blanking and burst are in analog,
+     * see the modulators' field_initialized
+     */
+    const void *sig_owner;
+    struct CRT_LINE done[CRT_MAX_LINES]; /* lines as they were last decoded */
+    struct CRT_OUTPUT done_out; /* and the output they were decoded into */
+    int done_valid; /* done[] is what the output image shows */
 };
 
-/* Initializes the library. Sets up filters.
+/* Get the descriptor of a system
+ *   system - one of the CRT_SYSTEMs
+ *
+ * returns NULL if the system does not exist
+ */
+extern const struct CRT_SYS *crt_get_sys(int system);
+
+/* Initializes the library for the CRT_SYSTEM it was compiled with.
+ * Sets up filters.
  *   w   - width of the output image
  *   h   - height of the output image
  *   f   - format of the output image
@@ -85,6 +293,15 @@ struct CRT {
  */
 extern void crt_init(struct CRT *v, int w, int h, int f, unsigned char *out);
 
+/* Same as crt_init() but for any of the systems. The analog signal in
+ * v->analog is v->sys->hres samples per line.
+ *   system - one of the CRT_SYSTEMs
+ *
+ * returns 0 if the system does not exist
+ */
+extern int crt_init_sys(struct CRT *v, int system,
+        int w, int h, int f, unsigned char *out);
+
 /* Updates the output image parameters
  *   w   - width of the output image
  *   h   - height of the output image
@@ -97,15 +314,76 @@ extern void crt_resize(struct CRT *v, int w, int h, int f, unsigned char *out);
 extern void crt_reset(struct CRT *v);
 
 /* Modulates RGB image into an analog NTSC signal
- *   s - struct containing settings to apply to this field
+ *   s - struct containing settings to apply to this field,
+ *       must be the NTSC_SETTINGS of the system v was initialized with
  */
 extern void crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s);
+
+/* Same as crt_modulate() but the active lines are encoded in bands on a
+ * worker pool. The output is identical to crt_modulate().
+ *   pool - worker pool from crt_pool_create(), NULL means single threaded
+ */
+extern void crt_modulate_mt(struct CRT *v, struct NTSC_SETTINGS *s,
+        struct CRT_POOL *pool);
     
 /* Demodulates the NTSC signal generated by crt_modulate()
  *   noise - the amount of noise added to the signal (0 - inf)
+ *
+ * With noise the signal is copied to v->inp first, the noise only depends
+ * on v->rn so the same seed always gives the same fields. Without noise
+ * v->analog is decoded as is and v->inp is left alone.
+ *
+ * The filters are the ones v->quality names at the time of the call, so
+ * a frontend that falls behind can switch to cheaper ones for a field.
+ * With v->chroma_dec set, I and Q are filtered at a half or a quarter of
+ * the sample rate and interpolated back when the line is scaled onto the
+ * output, which takes most of the chroma's share of the filtering away.
+ *
+ * With v->reuse set, a line whose analog signal, sync, color burst and
+ * output settings are the same as in the previous field is not decoded
+ * again, its rows are left as they are. The modulators mark the lines that
+ * came out different in v->dirty, lines whose hsync or vsync drifted are
+ * decoded again on their own. This needs noise == 0 and no blending, a
+ * noisy or blended field makes the next one decode every line.
+ * If you write to v->analog yourself, set the lines you changed in
+ * v->dirty. If you write to the output image, call crt_refresh().
  */
 extern void crt_demodulate(struct CRT *v, int noise);
 
+/* Makes the next crt_demodulate() decode every line even with v->reuse set,
+ * for when the output image was changed by something else
+ */
+extern void crt_refresh(struct CRT *v);
+
+/* Same as crt_demodulate() but the noise and the active lines are done in
+ * bands on a worker pool. Vsync and the per line hsync/color burst tracking
+ * are done serially in between. The output is identical to crt_demodulate().
+ *   pool  - worker pool from crt_pool_create(), NULL means single threaded
+ */
+extern void crt_demodulate_mt(struct CRT *v, int noise, struct CRT_POOL *pool);
+
+/* The two halves of decoding an active line, for fast paths that make the
+ * decoded line some other way (see crt_nes_fast.h).
+ *
+ * crt_eq_line() runs samples beg to end - 1 of a line through the
+ * demodulator's filters. Both always work at the full rate, whatever
+ * v->chroma_dec is.
+ *   sig          - signal of the line
+ *   waveI, waveQ - color carrier of the line, see struct CRT_LINE
+ *   bright       - added to the signal for luma
+ *   out          - the decoded samples are stored at the same indices
+ */
+extern void crt_eq_line(struct CRT *v, const signed char *sig, int beg, int end,
+        const int *waveI, const int *waveQ, int bright, struct YIQ *out);
+
+/* crt_put_line() scans a decoded line onto its rows of the output image,
+ * with the current output settings.
+ *   cl  - position and size of the line, as tracked by crt_demodulate()
+ *   yiq - the decoded line
+ */
+extern void crt_put_line(struct CRT *v, const struct CRT_LINE *cl,
+        const struct YIQ *yiq);
+
 /* Get the bytes per pixel for a certain CRT_PIX_FORMAT_
  * 
  *   format - the format to get the bytes per pixel for
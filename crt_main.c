@@ -16,6 +16,9 @@
 #include "ppm_rw.h"
 #include "bmp_rw.h"
 #include "crt_core.h"
+#include "crt_pool.h"
+#include "video_rw.h"
+#include "img_map.h"
 
 #ifndef CMD_LINE_VERSION
 #define CMD_LINE_VERSION 1
@@ -43,6 +46,8 @@ static int progressive = 0;
 static int raw = 0;
 static int hue = 0;
 static int save_analog = 0;
+static int video = 0;
+static int direct = 0;
 
 static int
 stoint(char *s, int *err)
@@ -71,8 +76,11 @@ usage(char *p)
 {
     printf(DRV_HEADER);
     printf("usage: %s -m|o|f|p|r|h|a outwidth outheight noise artifact_hue infile outfile\n", p);
+    printf("       %s -v[m|o|f|p|r] outwidth outheight noise artifact_hue infile outfile [inwidth inheight]\n", p);
     printf("sample usage: %s -op 640 480 24 0 in.ppm out.ppm\n", p);
     printf("sample usage: %s - 832 624 0 90 in.ppm out.ppm\n", p);
+    printf("sample usage: %s -v 640 480 12 0 in.y4m out.y4m\n", p);
+    printf("sample usage: %s -vo 640 480 12 0 - - 320 240 < in.rgb > out.rgb\n", p);
     printf("-- NOTE: the - after the program name is required\n");
     printf("\tartifact_hue is [0, 359]\n");
     printf("------------------------------------------------------------\n");
@@ -82,6 +90,10 @@ usage(char *p)
     printf("\tp : progressive scan (rather than interlaced)\n");
     printf("\tr : raw image (needed for images that use artifact colors)\n");
     printf("\ta : save analog signal as image instead of decoded image\n");
+    printf("\td : decode straight into the memory mapped output file (32-bit BMP or PPM)\n");
+    printf("\tv : video, infile and outfile are y4m or raw 24-bit RGB, - is stdin/stdout\n");
+    printf("\t    inwidth inheight give the size of raw input, without them it is y4m\n");
+    printf("\t    the output is y4m if it ends in .y4m or is - with y4m input\n");
     printf("\th : print help\n");
     printf("\n");
     printf("by default, the image will be full color, interlaced, and scaled to the output dimensions\n");
@@ -104,6 +116,8 @@ process_args(int argc, char **argv)
             case 'p': progressive = 1; break;
             case 'r': raw = 1;         break;
             case 'a': save_analog = 1; break;
+            case 'v': video = 1;       break;
+            case 'd': direct = 1;      break;
             case 'h': usage(argv[0]); return 0;
             default:
                 fprintf(stderr, "Unrecognized flag '%c'\n", *flags);
@@ -143,14 +157,195 @@ promptoverwrite(char *fn)
     return 1;
 }
 
+/* video is read, converted and written at the same time on three threads,
+ * at step n frame n is read while frame n - 1 is converted and frame n - 2
+ * is written
+ */
+struct PIPELINE {
+    struct VIDEO in;
+    struct VIDEO out;
+    struct CRT crt;
+    struct NTSC_SETTINGS ntsc;
+    struct CRT_POOL *work; /* for the conversion itself */
+    int noise;
+    int nfields;
+    int *src[2]; /* frames that were read */
+    int *dst[2]; /* frames to write */
+    int *screen; /* what the CRT draws on */
+    int n; /* step */
+    int run[3]; /* read, convert, write */
+    int ok[3];
+};
+
+static void
+convert_frame(struct PIPELINE *p, int *src, int *dst)
+{
+    int i;
+
+    p->ntsc.data = (unsigned char *) src;
+    for (i = 0; i < p->nfields; i++) {
+        if (!progressive) {
+            p->ntsc.field = i;
+        }
+        /* the second field is blended onto the first,
+         * the first one of a frame starts over
+         */
+        p->crt.blend = (i > 0);
+        crt_modulate_mt(&p->crt, &p->ntsc, p->work);
+        crt_demodulate_mt(&p->crt, p->noise, p->work);
+    }
+    /* the color subcarrier phase flips every frame */
+    p->ntsc.frame ^= 1;
+    memcpy(dst, p->screen, p->crt.outw * p->crt.outh * sizeof(int));
+}
+
+static void
+pipeline_job(void *ctx, int job, int worker)
+{
+    struct PIPELINE *p = ctx;
+
+    (void) worker;
+    if (!p->run[job]) {
+        return;
+    }
+    switch (job) {
+        case 0:
+            p->ok[0] = video_read(&p->in, p->src[p->n & 1]);
+            break;
+        case 1:
+            convert_frame(p, p->src[(p->n - 1) & 1], p->dst[(p->n - 1) & 1]);
+            p->ok[1] = 1;
+            break;
+        case 2:
+            p->ok[2] = video_write(&p->out, p->dst[(p->n - 2) & 1]);
+            break;
+    }
+}
+
+static int
+video_main(int outw, int outh, int noise,
+        char *input_file, char *output_file, int inw, int inh)
+{
+    static struct PIPELINE p;
+    struct CRT_POOL *io;
+    int i, y4m, mem, nread = 0, eof = 0, rerr = 0, ok = 0;
+
+    if (save_analog) {
+        fprintf(stderr, "saving the analog signal is not supported for video\n");
+        return 0;
+    }
+    if (!video_open_read(&p.in, input_file, inw, inh)) {
+        return 0;
+    }
+    fprintf(stderr, "loaded %dx%d %s video\n", p.in.w, p.in.h,
+            p.in.y4m ? "y4m" : "raw");
+
+    if (strcmp(output_file, "-") == 0) {
+        y4m = p.in.y4m;
+    } else {
+        y4m = (strlen(output_file) >= 4 && cmpsuf(output_file, ".y4m", 4) == 0);
+        if (dooverwrite && fileexist(output_file)) {
+            if (strcmp(input_file, "-") == 0) {
+                /* the answer would have to come from the video */
+                fprintf(stderr, "file (%s) already exists, use -o to overwrite\n",
+                        output_file);
+                goto done;
+            }
+            if (!promptoverwrite(output_file)) {
+                goto done;
+            }
+        }
+    }
+    if (p.in.y4m) {
+        i = video_open_write(&p.out, output_file, outw, outh,
+                y4m, p.in.fps_n, p.in.fps_d, !progressive);
+    } else {
+        i = video_open_write(&p.out, output_file, outw, outh,
+                y4m, 30000, 1001, !progressive);
+    }
+    if (!i) {
+        goto done;
+    }
+
+    p.screen = calloc(outw * outh, sizeof(int));
+    mem = (p.screen != NULL);
+    for (i = 0; i < 2; i++) {
+        p.src[i] = calloc(p.in.w * p.in.h, sizeof(int));
+        p.dst[i] = calloc(outw * outh, sizeof(int));
+        mem = mem && p.src[i] && p.dst[i];
+    }
+    if (!mem) {
+        fprintf(stderr, "out of memory\n");
+        goto done;
+    }
+
+    crt_init(&p.crt, outw, outh, CRT_PIX_FORMAT_BGRA, (unsigned char *) p.screen);
+    p.crt.blend = 0;
+    p.crt.scanlines = 1;
+    p.noise = noise;
+    p.nfields = progressive ? 1 : 2;
+    p.ntsc.format = CRT_PIX_FORMAT_BGRA;
+    p.ntsc.w = p.in.w;
+    p.ntsc.h = p.in.h;
+    p.ntsc.as_color = docolor;
+    p.ntsc.field = field & 1;
+    p.ntsc.raw = raw;
+    p.ntsc.hue = hue;
+    p.ntsc.frame = 0;
+
+    /* 3 threads for the stages, converting has a pool of its own */
+    io = crt_pool_create(3);
+    p.work = crt_pool_create(0);
+
+    fprintf(stderr, "converting to %dx%d...\n", outw, outh);
+    for (p.n = 0; ; p.n++) {
+        p.run[0] = !eof;
+        p.run[1] = (p.n >= 1 && p.n - 1 < nread);
+        p.run[2] = (p.n >= 2 && p.n - 2 < nread);
+        if (!p.run[0] && !p.run[1] && !p.run[2]) {
+            break;
+        }
+        crt_pool_run(io, pipeline_job, &p, 3);
+        if (p.run[0]) {
+            if (p.ok[0] > 0) {
+                nread++;
+            } else {
+                /* the frames that were read are still written on error */
+                eof = 1;
+                rerr = (p.ok[0] < 0);
+            }
+        }
+        if (p.run[2] && !p.ok[2]) {
+            break;
+        }
+    }
+    ok = (!p.run[2] || p.ok[2]) && !rerr;
+    crt_pool_destroy(p.work);
+    crt_pool_destroy(io);
+    fprintf(stderr, "%d frames\n", nread);
+done:
+    video_close(&p.in);
+    video_close(&p.out);
+    for (i = 0; i < 2; i++) {
+        free(p.src[i]);
+        free(p.dst[i]);
+    }
+    free(p.screen);
+    return ok;
+}
+
 int
 main(int argc, char **argv)
 {
     struct NTSC_SETTINGS ntsc;
-    struct CRT crt;
+    static struct CRT crt; /* too big for the stack, see crt_core.h */
+    struct CRT_POOL *pool;
     int *img;
     int imgw, imgh;
     int *output = NULL;
+    unsigned char *out = NULL;
+    struct IMG_MAP map;
+    int out_format = CRT_PIX_FORMAT_BGRA;
     int outw = 832;
     int outh = 624;
     int noise = 24;
@@ -167,7 +362,8 @@ main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-    printf(DRV_HEADER);
+    /* the video itself can be on stdout */
+    fprintf(video ? stderr : stdout, DRV_HEADER);
 
     outw = stoint(argv[2], &err);
     if (err) {
@@ -191,11 +387,25 @@ main(int argc, char **argv)
         return EXIT_FAILURE;
     }
     hue %= 360;
-    
-    output = calloc(outw * outh, sizeof(int));
-    if (output == NULL) {
-        printf("out of memory\n");
-        return EXIT_FAILURE;
+
+    if (video) {
+        int inw = 0, inh = 0;
+
+        if (argc > 9) {
+            inw = stoint(argv[8], &err);
+            if (err) {
+                return EXIT_FAILURE;
+            }
+            inh = stoint(argv[9], &err);
+            if (err) {
+                return EXIT_FAILURE;
+            }
+        }
+        if (!video_main(outw, outh, noise, argv[6], argv[7], inw, inh)) {
+            return EXIT_FAILURE;
+        }
+        fprintf(stderr, "done\n");
+        return EXIT_SUCCESS;
     }
 
     input_file = argv[6];
@@ -218,8 +428,31 @@ main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-    crt_init(&crt, outw, outh, CRT_PIX_FORMAT_BGRA, output);
+    if (direct && !save_analog) {
+        if (cmpsuf(output_file, ".ppm", 4) == 0) {
+            out = img_map(&map, output_file, IMG_MAP_PPM, outw, outh);
+            out_format = CRT_PIX_FORMAT_RGB;
+        } else {
+            out = img_map(&map, output_file, IMG_MAP_BMP, outw, outh);
+            out_format = CRT_PIX_FORMAT_BGRA;
+        }
+        if (out == NULL) {
+            printf("unable to map output, writing it afterwards instead\n");
+            out_format = CRT_PIX_FORMAT_BGRA;
+        }
+    }
+    if (out == NULL) {
+        output = calloc(outw * outh, sizeof(int));
+        if (output == NULL) {
+            printf("out of memory\n");
+            return EXIT_FAILURE;
+        }
+        out = (unsigned char *) output;
+    }
+    crt_init(&crt, outw, outh, out_format, out);
+    pool = crt_pool_create(0);
 
+    memset(&ntsc, 0, sizeof(ntsc));
     ntsc.data = img;
     ntsc.format = CRT_PIX_FORMAT_BGRA;
     ntsc.w = imgw;
@@ -238,12 +471,12 @@ main(int argc, char **argv)
    
     /* accumulate 4 frames */
     while (err < 4) {
-        crt_modulate(&crt, &ntsc);
-        crt_demodulate(&crt, noise);
+        crt_modulate_mt(&crt, &ntsc, pool);
+        crt_demodulate_mt(&crt, noise, pool);
         if (!progressive) {
             ntsc.field ^= 1;
-            crt_modulate(&crt, &ntsc);
-            crt_demodulate(&crt, noise);
+            crt_modulate_mt(&crt, &ntsc, pool);
+            crt_demodulate_mt(&crt, noise, pool);
             if ((err & 1) == 0) {
                 /* a frame is two fields */
                 ntsc.frame ^= 1;
@@ -251,18 +484,28 @@ main(int argc, char **argv)
         }
         err++;
     }
-        
+    crt_pool_destroy(pool);
+
+    if (out != (unsigned char *) output) {
+        /* it's already in the file */
+        if (!img_unmap(&map)) {
+            printf("unable to write image\n");
+            return EXIT_FAILURE;
+        }
+        printf("done\n");
+        return EXIT_SUCCESS;
+    }
     if (save_analog) {
         int i, norm;
         
         free(output);
-        output = calloc(CRT_HRES * CRT_VRES, sizeof(int));
-        for (i = 0; i < (CRT_HRES * CRT_VRES); i++) {
+        outw = crt.sys->hres;
+        outh = crt.sys->vres;
+        output = calloc(outw * outh, sizeof(int));
+        for (i = 0; i < (outw * outh); i++) {
             norm = crt.analog[i] + 128;
             output[i] = norm << 16 | norm << 8 | norm;
         }
-        outw = CRT_HRES;
-        outh = CRT_VRES;
     }
     
     if (cmpsuf(output_file, ".ppm", 4) == 0) {
@@ -292,6 +535,8 @@ static int *video = NULL;
 static VIDINFO *info;
 
 static struct CRT crt;
+static struct NTSC_SETTINGS ntsc;
+static struct CRT_POOL *pool;
 
 static int *img;
 static int imgw;
@@ -407,6 +652,21 @@ updatecb(void)
         crt.blend ^= 1;
         printf("crt.blend: %d\n", crt.blend);
     }
+    if (pkb_key_pressed('i')) {
+        /* only redecode the lines that changed */
+        crt.reuse ^= 1;
+        memset(video, 0, info->width * info->height * sizeof(int));
+        crt_refresh(&crt);
+        printf("crt.reuse: %d\n", crt.reuse);
+    }
+    if (pkb_key_pressed('k')) {
+        crt.quality = (crt.quality + 1) % 3;
+        printf("crt.quality: %d\n", crt.quality);
+    }
+    if (pkb_key_pressed('c')) {
+        crt.chroma_dec = (crt.chroma_dec + 1) % (CRT_CHROMA_DEC_MAX + 1);
+        printf("crt.chroma_dec: %d\n", crt.chroma_dec);
+    }
     if (pkb_key_pressed('f')) {
         field ^= 1;
         printf("field: %d\n", field);
@@ -421,12 +681,9 @@ updatecb(void)
          * their values resulting in the previous image being
          * displayed where the new, smaller image is not
          */
-#if (CRT_SYSTEM == CRT_SYSTEM_NTSC)
-        /* clearing the analog buffer with optimized NES mode will cause the
-         * image to break since the field does not get repopulated
-         */
-        memset(crt.analog, 0, sizeof(crt.analog));
-#endif
+        memset(crt.analog, 0, crt.sys->hres * crt.sys->vres);
+        /* the sync and blanking need to be written again too */
+        ntsc.field_initialized = 0;
         raw ^= 1;
         printf("raw: %d\n", raw);
     }
@@ -452,15 +709,14 @@ fade_phosphors(void)
 static void
 displaycb(void)
 {
-    static struct NTSC_SETTINGS ntsc;
-  
     if (fadephos) {
         fade_phosphors();
-    } else {
+        crt_refresh(&crt);
+    } else if (!crt.reuse) {
         memset(video, 0, info->width * info->height * sizeof(int));
     }
     /* not necessary to clear if you're rendering on a constant region of the display */
-    /* memset(crt.analog, 0, sizeof(crt.analog)); */
+    /* memset(crt.analog, 0, crt.sys->hres * crt.sys->vres); */
 #if (CRT_SYSTEM == CRT_SYSTEM_NES)
     ntsc.data = ppu_output_256x240;
     ntsc.border_color = 0x22;
@@ -483,10 +739,13 @@ displaycb(void)
     }
 #if (CRT_SYSTEM == CRT_SYSTEM_PV1K)
     ntsc.dot_crawl_offset = (ntsc.dot_crawl_offset + 1) % CRT_CC_VPER;
+#elif (CRT_SYSTEM == CRT_SYSTEM_NTSC)
+    /* make the chroma at the rate it gets filtered at */
+    ntsc.chroma_dec = crt.chroma_dec;
 #endif
 #endif
-    crt_modulate(&crt, &ntsc);
-    crt_demodulate(&crt, noise);
+    crt_modulate_mt(&crt, &ntsc, pool);
+    crt_demodulate_mt(&crt, noise, pool);
     if (!progressive) {
         field ^= 1;
     }
@@ -523,6 +782,7 @@ main(int argc, char **argv)
     printf(DRV_HEADER);
 
     crt_init(&crt, info->width, info->height, CRT_PIX_FORMAT_BGRA, video);
+    pool = crt_pool_create(0);
     crt.blend = 1;
     crt.scanlines = 1;
 
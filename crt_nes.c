@@ -11,9 +11,13 @@
  */
 /*****************************************************************************/
 
+/* build this system no matter which one is the default */
+#undef CRT_SYSTEM
+#define CRT_SYSTEM CRT_SYSTEM_NES
 #include "crt_core.h"
+#include "crt_pool.h"
+#include "crt_nes_fast.h"
 
-#if (CRT_SYSTEM == CRT_SYSTEM_NES)
 #include <stdlib.h>
 #include <string.h>
 
@@ -23,7 +27,7 @@ square_sample(int p, int phase)
 {
     /* amplified IRE = ((mV / 7.143) - 312 / 7.143) * 1024 */
     /* https://www.nesdev.org/wiki/NTSC_video#Brightness_Levels */
-    static int IRE[16] = {
+    static const int IRE[16] = {
      /* 0d     1d     2d      3d */
        -12042, 0,     34406,  81427,
      /* 0d     1d     2d      3d emphasized */
@@ -33,7 +37,7 @@ square_sample(int p, int phase)
      /* 00     10     20      30 emphasized */
         26951, 52181, 83721,  83721
     };
-    static int active[6] = {
+    static const int active[6] = {
         0300, 0100,
         0500, 0400,
         0600, 0200
@@ -60,6 +64,9 @@ square_sample(int p, int phase)
     return IRE[(l << 3) + (e << 2) + ((p >> 4) & 3)];
 }
 
+/* starting square wave phase of each line in the chroma period */
+static const int phasetab[CRT_CC_VPER] = { 0, 4, 8 };
+
 #define NES_OPTIMIZED 1
 /* toggle drawing of NES border
  * (normally not in visible region, but it depends on your emulator)
@@ -101,23 +108,135 @@ setup_field(struct CRT *v)
             while (t < CRT_HRES) line[t++] = BLANK_LEVEL;
         }
     }
+    memset(v->dirty, 1, sizeof(v->dirty));
 }
  
-extern void
-crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
+/* The square wave only depends on the pixel and the phase within the
+ * chroma period, so the four samples that are summed for each sample of the
+ * signal are looked up instead of generated.
+ */
+static void
+setup_sqtab(struct NTSC_SETTINGS *s)
+{
+    int p, phase;
+
+    for (p = 0; p < 512; p++) {
+        for (phase = 0; phase < NES_PHASES; phase++) {
+            s->sqtab[p][phase] = square_sample(p, phase + 0)
+                               + square_sample(p, phase + 1)
+                               + square_sample(p, phase + 2)
+                               + square_sample(p, phase + 3);
+        }
+    }
+}
+
+/* what every band of active lines needs from modulate() */
+struct MOD_JOB {
+    struct CRT *v;
+    struct NTSC_SETTINGS *s;
+    int destw, desth;
+    int xo, yo;
+    int nbands;
+    int cache; /* skip lines that are the same as last time */
+    int new_burst; /* the color burst changed */
+    int ccburst[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for burst */
+};
+
+/* modulates one band of active lines along with their color burst */
+static void
+mod_band(void *ctx, int job, int worker)
+{
+    struct MOD_JOB *mj = ctx;
+    struct CRT *v = mj->v;
+    struct NTSC_SETTINGS *s = mj->s;
+    int destw = mj->destw;
+    int desth = mj->desth;
+    int xo = mj->xo;
+    int yo = mj->yo;
+    int x, y, y0, y1, n, phase;
+
+    (void) worker;
+    y0 = (job + 0) * desth / mj->nbands;
+    y1 = (job + 1) * desth / mj->nbands;
+
+    for (y = y0; y < y1; y++) {
+        signed char *line;  
+        int t, cb;
+        int sy = (y * s->h) / desth;
+        
+        if (sy >= s->h) sy = s->h;
+        if (sy < 0) sy = 0;
+ 
+        n = (y + yo);
+        line = &v->analog[n * CRT_HRES];
+        
+        /* CB_CYCLES of color burst at 3.579545 Mhz */
+        for (t = CB_BEG; t < CB_BEG + (CB_CYCLES * CRT_CB_FREQ); t++) {
+            cb = mj->ccburst[n % CRT_CC_VPER][t % CRT_CC_SAMPLES];
+            line[t] = (BLANK_LEVEL + (cb * BURST_LEVEL)) >> 5;
+        }
+        if (mj->new_burst && n < CRT_VRES) {
+            v->dirty[n] = 1;
+        }
+        sy *= s->w;
+        phase = phasetab[(y + yo + s->dot_crawl_offset) % CRT_CC_VPER];
+        if (mj->cache) {
+            /* same pixels at the same phase give the same samples */
+            if (s->cache_phase[y] == phase &&
+                memcmp(s->cache_row[y], s->data + sy,
+                       s->w * sizeof(unsigned short)) == 0) {
+                continue;
+            }
+            s->cache_phase[y] = phase;
+            memcpy(s->cache_row[y], s->data + sy, s->w * sizeof(unsigned short));
+        }
+        if (n < CRT_VRES) {
+            v->dirty[n] = 1;
+        }
+        for (x = 0; x < destw; x++) {
+            int ire, p;
+            
+            /* bits above the 9th are ignored by the square wave */
+            p = s->data[((x * s->w) / destw) + sy] & 0x1ff;
+            ire = BLACK_LEVEL + v->black_point + s->sqtab[p][phase];
+            ire = (ire * v->white_point / 100) >> 12;
+            v->analog[(x + xo) + (y + yo) * CRT_HRES] = ire;
+            phase += 3;
+            if (phase >= NES_PHASES) {
+                phase -= NES_PHASES;
+            }
+        }
+    }
+}
+
+static void
+modulate(struct CRT *v, struct NTSC_SETTINGS *s, struct CRT_POOL *pool)
 {
+    struct MOD_JOB mj;
     int x, y, xo, yo;
     int destw = AV_LEN;
     int desth = CRT_LINES;
-    int n, phase;
+    int n;
     int iccf[CRT_CC_VPER][CRT_CC_SAMPLES];
-    int ccburst[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for burst */
     int sn, cs;
-    static int phasetab[CRT_CC_VPER] = { 0, 4, 8 };
-        
+
+    /* the cached sync and blanking, and the line cache, are only good for
+     * the CRT they were written to, and only while nothing else wrote
+     * over them
+     */
+    if (v->sig_owner != s || s->sig_crt != v) {
+        s->field_initialized = 0;
+    }
     if (!s->field_initialized) {
         setup_field(v);
         s->field_initialized = 1;
+        s->sig_crt = v;
+        v->sig_owner = s;
+        s->cache_valid = 0;
+    }
+    if (!s->sqtab_initialized) {
+        setup_sqtab(s);
+        s->sqtab_initialized = 1;
     }
 
     for (y = 0; y < CRT_CC_VPER; y++) {
@@ -125,7 +244,9 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
         for (x = 0; x < CRT_CC_SAMPLES; x++) {
             n = (s->hue + x * (360 / CRT_CC_SAMPLES) + xo + 33) % 360;
             crt_sincos14(&sn, &cs, n * 8192 / 180);
-            ccburst[y][x] = sn >> 10;
+            mj.ccburst[y][x] = sn >> 10;
+            /* what the burst looks like once it is in the signal */
+            iccf[y][x] = (signed char) ((BLANK_LEVEL + (mj.ccburst[y][x] * BURST_LEVEL)) >> 5);
         }
     }
 
@@ -134,64 +255,71 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
          
     /* align signal */
     xo = (xo & ~3);
+
+    if (s->cache_valid &&
+        (s->cache_w != s->w || s->cache_h != s->h ||
+         s->cache_xo != xo || s->cache_yo != yo ||
+         s->cache_bp != v->black_point || s->cache_wp != v->white_point)) {
+        s->cache_valid = 0;
+    }
+    mj.new_burst = !s->cache_valid ||
+                   s->cache_hue != s->hue ||
+                   s->cache_dco != s->dot_crawl_offset;
+    if (!s->cache_valid) {
+        for (y = 0; y < CRT_LINES; y++) {
+            s->cache_phase[y] = -1;
+        }
+        s->cache_w = s->w;
+        s->cache_h = s->h;
+        s->cache_xo = xo;
+        s->cache_yo = yo;
+        s->cache_bp = v->black_point;
+        s->cache_wp = v->white_point;
+        s->cache_valid = 1;
+    }
+    s->cache_hue = s->hue;
+    s->cache_dco = s->dot_crawl_offset;
+#if NES_BORDER
+    /* the border is drawn over the whole line every field */
+    mj.cache = 0;
+#else
+    mj.cache = (s->w <= AV_PPUpx);
+#endif
     
 #if NES_BORDER
     for (n = CRT_TOP; n <= (CRT_BOT + 2); n++) {
-        int t; /* time */
+        int t, phase; /* time */
         signed char *line = &v->analog[n * CRT_HRES];
         
         t = LINE_BEG;
  
         phase = phasetab[(n + s->dot_crawl_offset) % CRT_CC_VPER] + 6;
+        phase %= NES_PHASES;
         t = LAV_BEG;
         while (t < CRT_HRES) {
             int ire, p;
-            p = s->border_color;
+            p = s->border_color & 0x1ff;
             if (t == LAV_BEG) p = 0xf0;
-            ire = BLACK_LEVEL + v->black_point;
-            ire += square_sample(p, phase + 0);
-            ire += square_sample(p, phase + 1);
-            ire += square_sample(p, phase + 2);
-            ire += square_sample(p, phase + 3);
+            ire = BLACK_LEVEL + v->black_point + s->sqtab[p][phase];
             ire = (ire * v->white_point / 100) >> 12;
             line[t++] = ire;
             phase += 3;
+            if (phase >= NES_PHASES) {
+                phase -= NES_PHASES;
+            }
         }
+        v->dirty[n] = 1;
     }
 #endif
-    for (y = 0; y < desth; y++) {
-        signed char *line;  
-        int t, cb;
-        int sy = (y * s->h) / desth;
-        
-        if (sy >= s->h) sy = s->h;
-        if (sy < 0) sy = 0;
- 
-        n = (y + yo);
-        line = &v->analog[n * CRT_HRES];
-        
-        /* CB_CYCLES of color burst at 3.579545 Mhz */
-        for (t = CB_BEG; t < CB_BEG + (CB_CYCLES * CRT_CB_FREQ); t++) {
-            cb = ccburst[n % CRT_CC_VPER][t % CRT_CC_SAMPLES];
-            line[t] = (BLANK_LEVEL + (cb * BURST_LEVEL)) >> 5;
-            iccf[n % CRT_CC_VPER][t % CRT_CC_SAMPLES] = line[t];
-        }
-        sy *= s->w;
-        phase = phasetab[(y + yo + s->dot_crawl_offset) % CRT_CC_VPER];
-        for (x = 0; x < destw; x++) {
-            int ire, p;
-            
-            p = s->data[((x * s->w) / destw) + sy];
-            ire = BLACK_LEVEL + v->black_point;
-            ire += square_sample(p, phase + 0);
-            ire += square_sample(p, phase + 1);
-            ire += square_sample(p, phase + 2);
-            ire += square_sample(p, phase + 3);
-            ire = (ire * v->white_point / 100) >> 12;
-            v->analog[(x + xo) + (y + yo) * CRT_HRES] = ire;
-            phase += 3;
-        }
-    }
+    mj.v = v;
+    mj.s = s;
+    mj.destw = destw;
+    mj.desth = desth;
+    mj.xo = xo;
+    mj.yo = yo;
+    n = crt_pool_size(pool);
+    mj.nbands = (n == 1) ? 1 : (n * CRT_POOL_BANDS);
+    crt_pool_run(pool, mod_band, &mj, mj.nbands);
     
     for (n = 0; n < CRT_CC_VPER; n++) {
         for (x = 0; x < CRT_CC_SAMPLES; x++) {
@@ -199,10 +327,11 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
         }
     }
 }
+
 #else
 /* NOT NES_OPTIMIZED */
-extern void
-crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
+static void
+modulate(struct CRT *v, struct NTSC_SETTINGS *s, struct CRT_POOL *pool)
 {
     int x, y, xo, yo;
     int destw = AV_LEN;
@@ -211,8 +340,10 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     int iccf[CRT_CC_VPER][CRT_CC_SAMPLES];
     int ccburst[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for burst */
     int sn, cs;
-    static int phasetab[CRT_CC_VPER] = { 0, 4, 8 };
 
+    (void) pool;
+    /* every line is written */
+    memset(v->dirty, 1, sizeof(v->dirty));
     for (y = 0; y < CRT_CC_VPER; y++) {
         xo = (y + s->dot_crawl_offset) * (360 / CRT_CC_VPER);
         for (x = 0; x < CRT_CC_SAMPLES; x++) {
@@ -307,4 +438,311 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
 }
 #endif
 
-#endif
+/*****************************************************************************/
+/********************************* FAST MODE *********************************/
+/*****************************************************************************/
+
+/* the tables depend on these */
+static int
+fast_same(struct CRT *v, struct NTSC_SETTINGS *s, struct NES_FAST *f,
+        int xo, int yo)
+{
+    return f->built && f->crt == v &&
+           f->outw == v->outw && f->outh == v->outh && f->v_fac == v->v_fac &&
+           f->hue == v->hue && f->saturation == v->saturation &&
+           f->brightness == v->brightness &&
+           f->black_point == v->black_point &&
+           f->white_point == v->white_point &&
+           f->nes_hue == s->hue && f->xo == xo && f->yo == yo &&
+           f->quality == v->quality;
+}
+
+/* scratch space for making the responses */
+struct FAST_BUILD {
+    struct CRT *v;
+    const struct CRT_LINE *cl; /* line whose color carrier is used */
+    signed char bg[1 << NES_KAVG][NES_KLEN + 4]; /* small random signals */
+    int bgd[1 << NES_KAVG][3 * NES_KLEN]; /* and what they decode to */
+    struct YIQ yiq;
+};
+
+/* the samples mod_band() makes for n samples of pixel p,
+ * starting at sample x of a line with phase c
+ */
+static void
+fast_samples(struct CRT *v, int p, int c, int x, int n, signed char *px)
+{
+    int i, ire, phase;
+
+    phase = (phasetab[c] + 3 * x) % NES_PHASES;
+    for (i = 0; i < n; i++) {
+        ire = BLACK_LEVEL + v->black_point;
+        ire += square_sample(p, phase + 0);
+        ire += square_sample(p, phase + 1);
+        ire += square_sample(p, phase + 2);
+        ire += square_sample(p, phase + 3);
+        px[i] = (ire * v->white_point / 100) >> 12;
+        phase = (phase + 3) % NES_PHASES;
+    }
+}
+
+/* The filters round down, so a response measured on its own is a bit low
+ * and adding ~9 of them up would darken the picture. Instead it is the
+ * difference the samples make on top of a few small random signals, whose
+ * rounding errors cancel out. The random signals are blank where the
+ * samples go so the samples themselves enter the filters as they are.
+ */
+
+/* decodes the random signals blanked at samples j to j + n - 1 */
+static void
+fast_background(struct FAST_BUILD *fb, int j, int n)
+{
+    signed char sig[NES_KLEN + 4];
+    const struct CRT_LINE *cl = fb->cl;
+    int b, i;
+
+    for (b = 0; b < (1 << NES_KAVG); b++) {
+        memcpy(sig, fb->bg[b], sizeof(sig));
+        memset(sig + j, 0, n);
+        crt_eq_line(fb->v, sig, 0, j + NES_KLEN, cl->waveI, cl->waveQ,
+                0, &fb->yiq);
+        for (i = 0; i < NES_KLEN; i++) {
+            fb->bgd[b][i + NES_KLEN * 0] = fb->yiq.y[j + i];
+            fb->bgd[b][i + NES_KLEN * 1] = fb->yiq.i[j + i];
+            fb->bgd[b][i + NES_KLEN * 2] = fb->yiq.q[j + i];
+        }
+    }
+}
+
+/* response of samples px[0] to px[n - 1] placed at j, from j on,
+ * fast_background() must have been called with the same j and n
+ *   kp - the response, Y I Q, the sum of 1 << NES_KAVG of them
+ */
+static void
+fast_kernel(struct FAST_BUILD *fb, const signed char *px, int j, int n,
+        int *kp)
+{
+    signed char sig[NES_KLEN + 4];
+    const struct CRT_LINE *cl = fb->cl;
+    int b, i;
+
+    memset(kp, 0, sizeof(int) * 3 * NES_KLEN);
+    for (b = 0; b < (1 << NES_KAVG); b++) {
+        memcpy(sig, fb->bg[b], sizeof(sig));
+        memcpy(sig + j, px, n);
+        crt_eq_line(fb->v, sig, 0, j + NES_KLEN, cl->waveI, cl->waveQ,
+                0, &fb->yiq);
+        for (i = 0; i < NES_KLEN; i++) {
+            kp[i + NES_KLEN * 0] += fb->yiq.y[j + i];
+            kp[i + NES_KLEN * 1] += fb->yiq.i[j + i];
+            kp[i + NES_KLEN * 2] += fb->yiq.q[j + i];
+        }
+        for (i = 0; i < 3 * NES_KLEN; i++) {
+            kp[i] -= fb->bgd[b][i];
+        }
+    }
+}
+
+/* makes the decoded response of every pixel with the real modulator and
+ * demodulator filters, the sync is taken from a few regular fields
+ */
+static void
+fast_build(struct CRT *v, struct NTSC_SETTINGS *s, struct NES_FAST *f,
+        int xo, int yo)
+{
+    static const signed char blank[AV_LEN];
+    signed char px[4];
+    struct FAST_BUILD *fb;
+    struct CRT_LINE *cl;
+    int b, c, g, i, j, k, p, n, x0, x1, d;
+    unsigned rn = 1;
+
+    f->built = 0;
+    fb = malloc(sizeof(struct FAST_BUILD));
+    if (fb == NULL) {
+        return;
+    }
+    /* let the sync lock */
+    for (i = 0; i < 4; i++) {
+        crt_modulate(v, s);
+        crt_demodulate(v, 0);
+    }
+    memcpy(f->lines, v->lines, sizeof(f->lines));
+
+    f->crt = v;
+    f->outw = v->outw;
+    f->outh = v->outh;
+    f->v_fac = v->v_fac;
+    f->hue = v->hue;
+    f->saturation = v->saturation;
+    f->brightness = v->brightness;
+    f->black_point = v->black_point;
+    f->white_point = v->white_point;
+    f->nes_hue = s->hue;
+    f->xo = xo;
+    f->yo = yo;
+    f->quality = v->quality;
+
+    /* pixels are placed like mod_band() does with a 256 pixel image */
+    cl = &f->lines[CRT_LINES / 2];
+    d = xo - (int) (cl->pos % CRT_HRES);
+    f->nedge = 0;
+    for (k = 0; k < AV_PPUpx; k++) {
+        x0 = (k * AV_LEN + AV_PPUpx - 1) / AV_PPUpx;
+        x1 = ((k + 1) * AV_LEN + AV_PPUpx - 1) / AV_PPUpx;
+        f->beg[k] = x0 + d;
+        f->cls[k] = ((x0 & 3) << 1) | ((x1 - x0) > 2);
+        if (f->beg[k] < 0 && k < NES_KEDGE) {
+            f->nedge = k + 1;
+        }
+    }
+
+    crt_eq_line(v, blank, 0, AV_LEN, cl->waveI, cl->waveQ,
+            v->brightness - (BLACK_LEVEL + v->black_point), &f->base);
+    for (i = 0; i < AV_LEN; i++) {
+        f->base.y[i] <<= NES_KAVG;
+        f->base.i[i] <<= NES_KAVG;
+        f->base.q[i] <<= NES_KAVG;
+    }
+
+    fb->v = v;
+    for (b = 0; b < (1 << NES_KAVG); b++) {
+        for (i = 0; i < NES_KLEN + 4; i++) {
+            rn = (214019 * rn + 140327895);
+            fb->bg[b][i] = ((rn >> 16) & 7) - 4;
+        }
+    }
+    for (c = 0; c < CRT_CC_VPER; c++) {
+        /* a line in the middle of the picture with this phase */
+        for (i = 0; i < CRT_LINES; i++) {
+            fb->cl = &f->lines[(CRT_LINES / 2 + i) % CRT_LINES];
+            n = fb->cl->pos / CRT_HRES;
+            if ((n + s->dot_crawl_offset) % CRT_CC_VPER == c) {
+                break;
+            }
+        }
+        for (g = 0; g < NES_KCLS; g++) {
+            x0 = g >> 1;
+            n = 2 + (g & 1);
+            j = (x0 + d) & 3;
+            fast_background(fb, j, n);
+            for (p = 0; p < 512; p++) {
+                fast_samples(v, p, c, x0, n, px);
+                fast_kernel(fb, px, j, n, f->k[c][g][p]);
+            }
+        }
+        /* the filters start at sample 0, what comes before is cut off */
+        for (k = 0; k < f->nedge; k++) {
+            x0 = f->beg[k] - d;
+            x1 = f->beg[k + 1] - d;
+            n = x1 - x0 + f->beg[k];
+            if (n < 0) {
+                n = 0;
+            }
+            fast_background(fb, 0, n);
+            for (p = 0; p < 512; p++) {
+                fast_samples(v, p, c, x1 - n, n, px);
+                fast_kernel(fb, px, 0, n, f->edge[k][c][p]);
+            }
+        }
+    }
+    for (k = 0; k < f->nedge; k++) {
+        f->beg[k] = 0;
+    }
+    free(fb);
+    f->built = 1;
+}
+
+/* adds the responses of a line of pixels */
+static void
+fast_row(struct NES_FAST *f, const struct CRT_LINE *cl,
+        const unsigned short *row, int c)
+{
+    int k, i, t, t1;
+    int *ky, *ki, *kq;
+    int *ay, *ai, *aq;
+
+    for (k = 0; k < AV_PPUpx; k++) {
+        if (k < f->nedge) {
+            ky = f->edge[k][c][row[k] & 0x1ff];
+        } else {
+            ky = f->k[c][f->cls[k]][row[k] & 0x1ff];
+        }
+        ki = ky + NES_KLEN;
+        kq = ki + NES_KLEN;
+        i = f->beg[k];
+        ay = f->acc.y + i;
+        ai = f->acc.i + i;
+        aq = f->acc.q + i;
+        t = 0;
+        t1 = NES_KLEN;
+        if (i < cl->L) t = cl->L - i;
+        if (i + t1 > AV_LEN) t1 = AV_LEN - i;
+        for (; t < t1; t++) {
+            ay[t] += ky[t];
+            ai[t] += ki[t];
+            aq[t] += kq[t];
+        }
+    }
+}
+
+extern void
+crt_nes_fast(struct CRT *v, struct NTSC_SETTINGS *s, struct NES_FAST *f)
+{
+    struct CRT_LINE *cl;
+    int line, i, n, y, sy, xo, yo;
+
+    if (s->w != AV_PPUpx || crt_bpp4fmt(v->out_format) == 0) {
+        crt_modulate(v, s);
+        crt_demodulate(v, 0);
+        return;
+    }
+    xo = (AV_BEG + s->xoffset) & ~3;
+    yo = CRT_TOP + s->yoffset;
+    if (!fast_same(v, s, f, xo, yo)) {
+        fast_build(v, s, f, xo, yo);
+        if (!f->built) {
+            crt_modulate(v, s);
+            crt_demodulate(v, 0);
+            return;
+        }
+    }
+
+    for (line = 0; line < CRT_LINES; line++) {
+        cl = &f->lines[line];
+        if (cl->beg >= v->outh) {
+            continue;
+        }
+        memcpy(f->acc.y, f->base.y, sizeof(f->base.y));
+        memcpy(f->acc.i, f->base.i, sizeof(f->base.i));
+        memcpy(f->acc.q, f->base.q, sizeof(f->base.q));
+        n = cl->pos / CRT_HRES;
+        y = n - yo;
+        if (y >= 0 && y < CRT_LINES) {
+            sy = (y * s->h) / CRT_LINES;
+            fast_row(f, cl, s->data + sy * s->w,
+                    (n + s->dot_crawl_offset) % CRT_CC_VPER);
+        }
+        for (i = cl->L; i < AV_LEN; i++) {
+            f->acc.y[i] = (f->acc.y[i] + NES_KRND) >> NES_KAVG;
+            f->acc.i[i] = (f->acc.i[i] + NES_KRND) >> NES_KAVG;
+            f->acc.q[i] = (f->acc.q[i] + NES_KRND) >> NES_KAVG;
+        }
+        crt_put_line(v, cl, &f->acc);
+    }
+    /* the rows no longer show what v->lines decoded to */
+    v->done_valid = 0;
+}
+
+const struct CRT_SYS crt_sys_nes = {
+    CRT_SYSTEM_NES, "NES",
+    CRT_HRES, CRT_VRES,
+    CRT_TOP, CRT_BOT, CRT_LINES,
+    AV_BEG, AV_LEN,
+    SYNC_BEG,
+    CB_BEG, (CB_CYCLES * CRT_CB_FREQ),
+    CRT_CC_SAMPLES, CRT_CC_VPER,
+    L_FREQ,
+    BLACK_LEVEL, SYNC_LEVEL,
+    modulate
+};
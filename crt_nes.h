@@ -118,6 +118,9 @@ extern "C" {
 /* somewhere between 7 and 12 cycles */
 #define CB_CYCLES   10
 
+/* number of phases of the square wave in one chroma period */
+#define NES_PHASES       12
+
 /* line frequency */
 #define L_FREQ           1431818 /* full line */
 
@@ -139,7 +142,26 @@ struct NTSC_SETTINGS {
     int xoffset;    /* x offset in sample space. 0 is minimum value */
     int yoffset;    /* y offset in # of lines. 0 is minimum value */
     /* make sure your NTSC_SETTINGS struct is zeroed out before you do anything */
+    /* sync and blanking are in the CRT's analog signal,
+     * set to 0 if you clear or change the analog signal yourself.
+     * crt_init and crt_init_sys clear it for you.
+     */
     int field_initialized; /* internal state */
+    const struct CRT *sig_crt; /* internal state, CRT the above is for */
+    int sqtab_initialized; /* internal state */
+    /* internal state, sum of the 4 square wave samples that make up one
+     * sample of the signal, for every 9-bit pixel and starting phase
+     */
+    int sqtab[512][NES_PHASES];
+    /* internal state, what each active line was last encoded from so lines
+     * that did not change are skipped. Only used for images up to
+     * AV_PPUpx pixels wide.
+     */
+    int cache_valid;
+    int cache_w, cache_h, cache_xo, cache_yo;
+    int cache_bp, cache_wp, cache_hue, cache_dco;
+    int cache_phase[CRT_LINES];
+    unsigned short cache_row[CRT_LINES][AV_PPUpx];
 };
 
 #ifdef __cplusplus
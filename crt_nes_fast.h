@@ -0,0 +1,103 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *   modifications for Mesen by Persune
+ *   https://github.com/LMP88959/NTSC-CRT
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#ifndef _CRT_NES_FAST_H_
+#define _CRT_NES_FAST_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* crt_nes_fast.h
+ *
+ * Fast NES mode, for emulators that want the NES look without noise or
+ * sync that moves around.
+ *
+ * The modulator and the demodulator's filters are linear, so the decoded
+ * line is the sum of what every pixel decodes to on its own. That only
+ * depends on the 9-bit pixel, the phase of the color carrier it starts at,
+ * how many samples it covers and which of the 3 phases the line has.
+ * Those responses are made once with the real square wave and filters and
+ * after that a field is decoded by adding them up, no analog signal is
+ * made. Rounding in the filters makes the sum differ slightly from the
+ * real decoded line (a couple of levels per RGB channel on average).
+ *
+ * Every line is decoded with the sync and color carrier the CRT settled
+ * on when the tables were made, so the first lines after blank ones at the
+ * top (yoffset > 0), where a real CRT is still picking up the color burst,
+ * are a bit off. The border of NES_BORDER is not drawn.
+ *
+ * Define CRT_SYSTEM as CRT_SYSTEM_NES before including this.
+ *
+ */
+
+#include "crt_core.h"
+
+#if (CRT_SYSTEM != CRT_SYSTEM_NES)
+#error crt_nes_fast.h needs the NES NTSC_SETTINGS
+#endif
+
+/* samples of a pixel's decoded response that are kept */
+#define NES_KLEN  24
+/* a pixel is 2 or 3 samples long and starts at one of 4 carrier phases */
+#define NES_KCLS  8
+/* the responses are kept with this many extra bits */
+#define NES_KAVG  3
+#define NES_KRND  (1 << (NES_KAVG - 1))
+/* pixels at the left that can start before the decoded part of the line */
+#define NES_KEDGE 2
+
+struct NES_FAST {
+    /* what the tables were made for */
+    int built;
+    const struct CRT *crt;
+    int outw, outh;
+    unsigned v_fac;
+    int hue, saturation, brightness, black_point, white_point;
+    int nes_hue, xo, yo;
+    int quality;
+
+    struct CRT_LINE lines[CRT_LINES]; /* where each line goes */
+    int beg[AV_PPUpx]; /* first sample of each pixel on the decoded line */
+    int cls[AV_PPUpx]; /* kernel class of each pixel */
+    int nedge; /* number of pixels that use edge[] */
+    struct YIQ base; /* decoded line with all pixels blank */
+    struct YIQ acc; /* line being decoded */
+    /* decoded response of every pixel, Y I Q one after the other:
+     * [line phase][kernel class][9-bit pixel]
+     */
+    int k[CRT_CC_VPER][NES_KCLS][512][3 * NES_KLEN];
+    /* responses of the pixels that are cut off at the left */
+    int edge[NES_KEDGE][CRT_CC_VPER][512][3 * NES_KLEN];
+};
+
+/* Decodes a field of NES pixels straight to the output image.
+ * Does the same as crt_modulate() + crt_demodulate(v, 0), only faster.
+ * The output is close to the real thing but not identical.
+ *   s - NES settings, the image must be 256 pixels wide, otherwise this
+ *       falls back to crt_modulate() + crt_demodulate()
+ *   f - tables (a few MB, allocate it), zero it before the first call.
+ *       They are remade when the CRT, output size, offsets or color
+ *       settings change, which takes about as long as 20 regular fields.
+ *       v->analog is used while they are made.
+ * v->blend and v->scanlines work as usual, there is no noise, and v->reuse
+ * and v->chroma_dec are ignored (the tables are always made with full rate
+ * chroma).
+ */
+extern void crt_nes_fast(struct CRT *v, struct NTSC_SETTINGS *s,
+        struct NES_FAST *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
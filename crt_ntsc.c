@@ -9,9 +9,12 @@
  */
 /*****************************************************************************/
 
+/* build this system no matter which one is the default */
+#undef CRT_SYSTEM
+#define CRT_SYSTEM CRT_SYSTEM_NTSC
 #include "crt_core.h"
+#include "crt_pool.h"
 
-#if (CRT_SYSTEM == CRT_SYSTEM_NTSC)
 #include <stdlib.h>
 #include <string.h>
 
@@ -29,7 +32,7 @@
 #define EXP_MUL(x, y) (((x) * (y)) >> EXP_P)
 #define EXP_DIV(x, y) (((x) << EXP_P) / (y))
 
-static int e11[] = {
+static const int e11[] = {
     EXP_ONE,
     5567,  /* e   */
     15133, /* e^2 */
@@ -86,12 +89,6 @@ expx(int n)
 /********************************* FILTERS ***********************************/
 /*****************************************************************************/
 
-/* infinite impulse response low pass filter for bandlimiting YIQ */
-static struct IIRLP {
-    int c;
-    int h; /* history */
-} iirY, iirI, iirQ;
-
 /* freq  - total bandwidth
  * limit - max frequency
  */
@@ -125,9 +122,367 @@ iirf(struct IIRLP *f, int s)
 #endif
 }
 
-extern void
-crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
+/* delay of a low pass in 1/4096 samples */
+static int
+iir_delay(const struct IIRLP *f)
+{
+    return ((EXP_ONE - f->c) << 12) / f->c;
+}
+
+/* Where the chroma made at 1 / 2^k of the rate sits, in 1/4096 samples:
+ * chroma sample g is taken as sample (g << k) + offset. That is the middle
+ * of the samples it was made from plus the delay the filter at the full
+ * rate has more than the one at the reduced rate.
+ *   full, dec - the filter at the full and at the reduced rate
+ */
+static int
+dec_offset(const struct IIRLP *full, const struct IIRLP *dec, int k)
+{
+    int d = 1 << k;
+    int off = ((d - 1) << 11) + iir_delay(full) - d * iir_delay(dec);
+
+    /* mod_row_dec() moves on to the next chroma within every group */
+    return (off < 0) ? 0 : (off > ((d - 1) << 12)) ? ((d - 1) << 12) : off;
+}
+
+#define CB_LEN           (CB_CYCLES * CRT_CB_FREQ)
+/* lines with an hsync pulse and a color burst */
+#define VIDEO_LINE(n)    ((n) >= 10)
+/* lines that differ between the even and odd field */
+#define VSYNC_LINE(n)    ((n) >= 4 && (n) <= 6)
+
+/* writes the sync and blanking of a line, the color burst is left alone
+ * and so is the active video of the lines that can have an image.
+ * As long as v->analog does not get cleared this only has to be done
+ * once, after that only the lines that depend on the field are updated.
+ */
+static void
+blank_line(struct CRT *v, int n, int field)
+{
+    int t = LINE_BEG; /* time */
+    signed char *line = &v->analog[n * CRT_HRES];
+
+    if (n <= 3 || (n >= 7 && n <= 9)) {
+        /* equalizing pulses - small blips of sync, mostly blank */
+        while (t < (4   * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
+        while (t < (50  * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+        while (t < (54  * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
+        while (t < (100 * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+    } else if (n >= 4 && n <= 6) {
+        int even[4] = { 46, 50, 96, 100 };
+        int odd[4] =  { 4, 50, 96, 100 };
+        int *offs = even;
+        if (field == 1) {
+            offs = odd;
+        }
+        /* vertical sync pulse - small blips of blank, mostly sync */
+        while (t < (offs[0] * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
+        while (t < (offs[1] * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+        while (t < (offs[2] * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
+        while (t < (offs[3] * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+    } else {
+        /* video line */
+        while (t < SYNC_BEG) line[t++] = BLANK_LEVEL; /* FP */
+        while (t < BW_BEG)   line[t++] = SYNC_LEVEL;  /* SYNC */
+        while (t < AV_BEG)   line[t++] = BLANK_LEVEL; /* BW + CB + BP */
+        if (n < CRT_TOP) {
+            while (t < CRT_HRES) line[t++] = BLANK_LEVEL;
+        }
+    }
+}
+
+/* horizontal source pixel of every modulated sample, only recomputed
+ * when the image width or the modulated width changes
+ */
+static void
+update_xmap(struct NTSC_SETTINGS *s, int destw)
+{
+    int x;
+
+    if (s->xmap_w == s->w && s->xmap_destw == destw) {
+        return;
+    }
+    for (x = 0; x < destw; x++) {
+        s->xmap[x] = (x * s->w) / destw;
+    }
+    s->xmap_w = s->w;
+    s->xmap_destw = destw;
+}
+
+/* reads the source pixels of one modulated line into R, G, B planes
+ *   src - first pixel of the source row
+ *   n   - number of samples
+ */
+static void
+read_row(const struct NTSC_SETTINGS *s, const unsigned char *src, int n,
+        int *r, int *g, int *b)
+{
+    const int *map = s->xmap;
+    int bpp = crt_bpp4fmt(s->format);
+    int ro, go, bo; /* byte offsets of the channels */
+    int x;
+
+    switch (s->format) {
+        case CRT_PIX_FORMAT_RGB:
+        case CRT_PIX_FORMAT_RGBA:
+            ro = 0;
+            go = 1;
+            bo = 2;
+            break;
+        case CRT_PIX_FORMAT_BGR: 
+        case CRT_PIX_FORMAT_BGRA:
+            ro = 2;
+            go = 1;
+            bo = 0;
+            break;
+        case CRT_PIX_FORMAT_ARGB:
+            ro = 1;
+            go = 2;
+            bo = 3;
+            break;
+        case CRT_PIX_FORMAT_ABGR:
+            ro = 3;
+            go = 2;
+            bo = 1;
+            break;
+        default:
+            return;
+    }
+    for (x = 0; x < n; x++) {
+        const unsigned char *pix = src + map[x] * bpp;
+        r[x] = pix[ro];
+        g[x] = pix[go];
+        b[x] = pix[bo];
+    }
+}
+
+/* what every band of active lines needs from modulate() */
+struct MOD_JOB {
+    struct CRT *v;
+    struct NTSC_SETTINGS *s;
+    int destw, desth;
+    int xo, yo;
+    int ph; /* phase of the chroma pattern */
+    int bpp;
+    int nbands;
+    int k; /* s->chroma_dec in use */
+    int ccmodI[CRT_CC_SAMPLES]; /* color phase for mod */
+    int ccmodQ[CRT_CC_SAMPLES]; /* color phase for mod */
+};
+
+/* samples past the end of a row that mod_row_dec() makes up */
+#define DEC_PAD (3 << CRT_CHROMA_DEC_MAX)
+
+/* modulates the active video of one line with I and Q at 1 / 2^k of the
+ * rate. They are made from the sum of the colors of every 2^k samples,
+ * bandlimited by iirI and iirQ for that rate and interpolated back where
+ * they get onto the carrier, so only Y is bandlimited per sample.
+ *   r, g, b - source row, DEC_PAD samples longer than the line
+ *   line    - modulated row, DEC_PAD samples longer than the line
+ */
+static void
+mod_row_dec(struct MOD_JOB *mj, int *r, int *g, int *b, signed char *line,
+        struct IIRLP *iirY, struct IIRLP *iirI, struct IIRLP *iirQ)
+{
+    struct CRT *v = mj->v;
+    struct IIRLP fY = *iirY, fI = *iirI, fQ = *iirQ;
+    int k = mj->k;
+    int d = 1 << k;
+    int off = mj->s->dec_off[k - 1];
+    int destw = mj->destw;
+    int ng = (destw + d - 1) >> k; /* number of groups */
+    /* bandlimited chroma of every group after a 0 for before the line */
+    int ci[(AV_LEN >> 1) + 4], cq[(AV_LEN >> 1) + 4];
+    int modI[CRT_CC_SAMPLES], modQ[CRT_CC_SAMPLES];
+    int x, j, m0, fa, fb, p, lo, wl;
+    int rs, gs, bs; /* colors of a group */
+    int ai, aq, si, sq; /* chroma and its step, in 1/4096 */
+
+    /* the line goes on with its last sample for two groups */
+    for (x = destw; x < ((ng + 2) << k); x++) {
+        r[x] = r[destw - 1];
+        g[x] = g[destw - 1];
+        b[x] = b[destw - 1];
+    }
+    for (x = 0; x < CRT_CC_SAMPLES; x++) {
+        p = (x + mj->xo) % CRT_CC_SAMPLES;
+        modI[x] = mj->ph * mj->ccmodI[p];
+        modQ[x] = mj->ph * mj->ccmodQ[p];
+    }
+    lo = BLACK_LEVEL + v->black_point;
+    wl = WHITE_LEVEL * v->white_point / 100;
+    /* sample (j << k) + m is (m << 12) - off in 1/4096 samples past the
+     * middle of group j, 0 <= off <= d - 1 samples. From m0 on it is between
+     * the chroma of group j and j + 1, fb / 4096 of the way at m = m0,
+     * which goes on until m0 in the next group. The samples before m0 in
+     * group 0 are between a 0 and group 0, fa / 4096 of the way at 0.
+     */
+    m0 = (off + 4095) >> 12;
+    fa = (-off >> k) & 0xfff;
+    fb = (((m0 << 12) - off) >> k) & 0xfff;
+
+    rs = 0;
+    gs = 0;
+    bs = 0;
+    for (x = 0; x < d; x++) {
+        rs += r[x];
+        gs += g[x];
+        bs += b[x];
+    }
+    ci[0] = 0;
+    cq[0] = 0;
+    ci[1] = iirf(&fI, (39059 * rs - 18022 * gs - 21103 * bs) >> (14 + k));
+    cq[1] = iirf(&fQ, (13894 * rs - 34275 * gs + 20382 * bs) >> (14 + k));
+    ai = ci[1] * fa;
+    aq = cq[1] * fa;
+    si = ci[1] * 4096 >> k;
+    sq = cq[1] * 4096 >> k;
+    /* group j + 1 is summed from m0 in group j - 1 on */
+    rs = 0;
+    gs = 0;
+    bs = 0;
+    for (x = d; x < 2 * d - m0; x++) {
+        rs += r[x];
+        gs += g[x];
+        bs += b[x];
+    }
+    p = 0;
+    for (x = 0; x < (ng << k); x++) {
+        int fy, fc, ire;
+
+        if ((x & (d - 1)) == m0) {
+            /* ci[j + 1] is group j */
+            j = x >> k;
+            ci[j + 2] = iirf(&fI, (39059 * rs - 18022 * gs - 21103 * bs) >> (14 + k));
+            cq[j + 2] = iirf(&fQ, (13894 * rs - 34275 * gs + 20382 * bs) >> (14 + k));
+            rs = 0;
+            gs = 0;
+            bs = 0;
+            ai = ci[j + 1] * 4096 + (ci[j + 2] - ci[j + 1]) * fb;
+            aq = cq[j + 1] * 4096 + (cq[j + 2] - cq[j + 1]) * fb;
+            si = (ci[j + 2] - ci[j + 1]) * 4096 >> k;
+            sq = (cq[j + 2] - cq[j + 1]) * 4096 >> k;
+        }
+        rs += r[x + 2 * d - m0];
+        gs += g[x + 2 * d - m0];
+        bs += b[x + 2 * d - m0];
+
+        fy = (19595 * r[x] + 38470 * g[x] + 7471 * b[x]) >> 14;
+        fy = iirf(&fY, fy);
+        fc = ((ai >> 12) * modI[p] >> 4) + ((aq >> 12) * modQ[p] >> 4);
+        ire = lo + ((fy + fc) * wl >> 10);
+        if (ire < 0)   ire = 0;
+        if (ire > 110) ire = 110;
+        line[x] = ire;
+        ai += si;
+        aq += sq;
+        if (++p == CRT_CC_SAMPLES) {
+            p = 0;
+        }
+    }
+    *iirY = fY;
+    *iirI = fI;
+    *iirQ = fQ;
+}
+
+/* modulates one band of active lines, the IIR history is reset every line
+ * so the bands do not depend on each other
+ */
+static void
+mod_band(void *ctx, int job, int worker)
+{
+    struct MOD_JOB *mj = ctx;
+    struct CRT *v = mj->v;
+    struct NTSC_SETTINGS *s = mj->s;
+    struct IIRLP iirY, iirI, iirQ;
+    int destw = mj->destw;
+    int desth = mj->desth;
+    int xo = mj->xo;
+    int yo = mj->yo;
+    int ph = mj->ph;
+    int bpp = mj->bpp;
+    int *ccmodI = mj->ccmodI;
+    int *ccmodQ = mj->ccmodQ;
+    /* source row */
+    int r[AV_LEN + DEC_PAD], g[AV_LEN + DEC_PAD], b[AV_LEN + DEC_PAD];
+    signed char line[AV_LEN + DEC_PAD]; /* modulated row */
+    int x, y, y0, y1, n;
+
+    (void) worker;
+    iirY = s->iirY;
+    iirI = (mj->k) ? s->iirIdec[mj->k - 1] : s->iirI;
+    iirQ = (mj->k) ? s->iirQdec[mj->k - 1] : s->iirQ;
+    y0 = (job + 0) * desth / mj->nbands;
+    y1 = (job + 1) * desth / mj->nbands;
+
+    for (y = y0; y < y1; y++) {
+        int field_offset;
+        int sy;
+        
+        field_offset = (s->field * s->h + desth) / desth / 2;
+        sy = (y * s->h) / desth;
+    
+        sy += field_offset;
+
+        if (sy >= s->h) sy = s->h;
+        
+        sy *= s->w;
+        
+        read_row(s, s->data + sy * bpp, destw, r, g, b);
+        
+        reset_iir(&iirY);
+        reset_iir(&iirI);
+        reset_iir(&iirQ);
+        
+        if (mj->k) {
+            mod_row_dec(mj, r, g, b, line, &iirY, &iirI, &iirQ);
+        } else {
+            for (x = 0; x < destw; x++) {
+                int fy, fi, fq;
+                int rA, gA, bA;
+                int ire; /* composite signal */
+                int xoff;
+            
+                rA = r[x];
+                gA = g[x];
+                bA = b[x];
+
+                /* RGB to YIQ */
+                fy = (19595 * rA + 38470 * gA +  7471 * bA) >> 14;
+                fi = (39059 * rA - 18022 * gA - 21103 * bA) >> 14;
+                fq = (13894 * rA - 34275 * gA + 20382 * bA) >> 14;
+                ire = BLACK_LEVEL + v->black_point;
+            
+                xoff = (x + xo) % CRT_CC_SAMPLES;
+                /* bandlimit Y,I,Q */
+                fy = iirf(&iirY, fy);
+                fi = iirf(&iirI, fi) * ph * ccmodI[xoff] >> 4;
+                fq = iirf(&iirQ, fq) * ph * ccmodQ[xoff] >> 4;
+                ire += (fy + fi + fq) * (WHITE_LEVEL * v->white_point / 100) >> 10;
+                if (ire < 0)   ire = 0;
+                if (ire > 110) ire = 110;
+
+                line[x] = ire;
+            }
+        }
+        /* only lines that came out different have to be decoded again */
+        n = xo + (y + yo) * CRT_HRES;
+        if (memcmp(&v->analog[n], line, destw) != 0) {
+            memcpy(&v->analog[n], line, destw);
+            /* only this band's own line, modulate() does the ones that
+             * an image that is too wide runs into
+             */
+            if (y + yo < CRT_VRES) {
+                v->dirty[y + yo] = 1;
+            }
+        }
+    }
+}
+
+static void
+modulate(struct CRT *v, struct NTSC_SETTINGS *s, struct CRT_POOL *pool)
 {
+    struct MOD_JOB mj;
     int x, y, xo, yo;
     int destw = AV_LEN;
     int desth = ((CRT_LINES * 64500) >> 16);
@@ -135,14 +490,24 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     int ccmodI[CRT_CC_SAMPLES]; /* color phase for mod */
     int ccmodQ[CRT_CC_SAMPLES]; /* color phase for mod */
     int ccburst[CRT_CC_SAMPLES]; /* color phase for burst */
-    int sn, cs, n, ph;
+    signed char burst[CB_LEN];
+    int sn, cs, n, t, ph;
     int inv_phase = 0;
+    int new_burst = 0, redo = 0;
     int bpp;
 
+
     if (!s->iirs_initialized) {
-        init_iir(&iirY, L_FREQ, Y_FREQ);
-        init_iir(&iirI, L_FREQ, I_FREQ);
-        init_iir(&iirQ, L_FREQ, Q_FREQ);
+        init_iir(&s->iirY, L_FREQ, Y_FREQ);
+        init_iir(&s->iirI, L_FREQ, I_FREQ);
+        init_iir(&s->iirQ, L_FREQ, Q_FREQ);
+        for (x = 0; x < CRT_CHROMA_DEC_MAX; x++) {
+            /* the same filters at 1 / 2^(x + 1) of the rate */
+            init_iir(&s->iirIdec[x], L_FREQ >> (x + 1), I_FREQ);
+            init_iir(&s->iirQdec[x], L_FREQ >> (x + 1), Q_FREQ);
+            s->dec_off[x] = (dec_offset(&s->iirI, &s->iirIdec[x], x + 1) +
+                             dec_offset(&s->iirQ, &s->iirQdec[x], x + 1)) / 2;
+        }
         s->iirs_initialized = 1;
     }
 #if CRT_DO_BLOOM
@@ -191,6 +556,7 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     if (bpp == 0) {
         return; /* just to be safe */
     }
+    update_xmap(s, destw);
     xo = AV_BEG  + s->xoffset + (AV_LEN    - destw) / 2;
     yo = CRT_TOP + s->yoffset + (CRT_LINES - desth) / 2;
     
@@ -202,130 +568,130 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     /* align signal */
     xo = (xo & ~3);
     
-    for (n = 0; n < CRT_VRES; n++) {
-        int t; /* time */
-        signed char *line = &v->analog[n * CRT_HRES];
-        
-        t = LINE_BEG;
-
-        if (n <= 3 || (n >= 7 && n <= 9)) {
-            /* equalizing pulses - small blips of sync, mostly blank */
-            while (t < (4   * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
-            while (t < (50  * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
-            while (t < (54  * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
-            while (t < (100 * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
-        } else if (n >= 4 && n <= 6) {
-            int even[4] = { 46, 50, 96, 100 };
-            int odd[4] =  { 4, 50, 96, 100 };
-            int *offs = even;
-            if (s->field == 1) {
-                offs = odd;
-            }
-            /* vertical sync pulse - small blips of blank, mostly sync */
-            while (t < (offs[0] * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
-            while (t < (offs[1] * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
-            while (t < (offs[2] * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
-            while (t < (offs[3] * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
-        } else {
-            int cb;
-
-            /* video line */
-            while (t < SYNC_BEG) line[t++] = BLANK_LEVEL; /* FP */
-            while (t < BW_BEG)   line[t++] = SYNC_LEVEL;  /* SYNC */
-            while (t < AV_BEG)   line[t++] = BLANK_LEVEL; /* BW + CB + BP */
-            if (n < CRT_TOP) {
-                while (t < CRT_HRES) line[t++] = BLANK_LEVEL;
-            }
+    /* the image covers part of the sync or blanking,
+     * so all of it has to be written again next field
+     */
+    if (xo < AV_BEG || (xo + destw) > CRT_HRES ||
+        yo < CRT_TOP || (yo + desth) > CRT_VRES) {
+        redo = 1;
+    }
 
-            /* CB_CYCLES of color burst at 3.579545 Mhz */
-            for (t = CB_BEG; t < CB_BEG + (CB_CYCLES * CRT_CB_FREQ); t++) {
+    /* CB_CYCLES of color burst at 3.579545 Mhz */
+    for (t = CB_BEG; t < CB_BEG + CB_LEN; t++) {
+        int cb;
 #if (CRT_CHROMA_PATTERN == 1)
-                int off180 = CRT_CC_SAMPLES / 2;
-                cb = ccburst[(t + inv_phase * off180) % CRT_CC_SAMPLES];
+        int off180 = CRT_CC_SAMPLES / 2;
+        cb = ccburst[(t + inv_phase * off180) % CRT_CC_SAMPLES];
 #else
-                cb = ccburst[t % CRT_CC_SAMPLES];
+        cb = ccburst[t % CRT_CC_SAMPLES];
 #endif
-                line[t] = (BLANK_LEVEL + (cb * BURST_LEVEL)) >> 5;
-                iccf[t % CRT_CC_SAMPLES] = line[t];
+        burst[t - CB_BEG] = (BLANK_LEVEL + (cb * BURST_LEVEL)) >> 5;
+        iccf[t % CRT_CC_SAMPLES] = burst[t - CB_BEG];
+    }
+
+    /* the image overwrites the same part of the blanking every field,
+     * it only has to be written again when the image moved
+     */
+    if (s->redo && (s->redo_xo != xo || s->redo_yo != yo ||
+                    s->redo_w != destw || s->redo_h != desth)) {
+        s->field_initialized = 0;
+    }
+    /* the cached sync and blanking are only good for the CRT they
+     * were written to, and only while nothing else wrote over them
+     */
+    if (v->sig_owner != s || s->sig_crt != v) {
+        s->field_initialized = 0;
+    }
+    if (!s->field_initialized) {
+        for (n = 0; n < CRT_VRES; n++) {
+            blank_line(v, n, s->field);
+        }
+        memset(v->dirty, 1, sizeof(v->dirty));
+        s->blank_field = s->field;
+        s->field_initialized = 1;
+        s->sig_crt = v;
+        v->sig_owner = s;
+        new_burst = 1;
+    } else if (s->blank_field != s->field) {
+        for (n = 0; n < CRT_VRES; n++) {
+            if (VSYNC_LINE(n)) {
+                blank_line(v, n, s->field);
+                v->dirty[n] = 1;
+            }
+        }
+        s->blank_field = s->field;
+    }
+    if (new_burst || memcmp(s->burst, burst, CB_LEN) != 0) {
+        for (n = 0; n < CRT_VRES; n++) {
+            if (VIDEO_LINE(n)) {
+                v->dirty[n] = 1;
+                memcpy(&v->analog[n * CRT_HRES + CB_BEG], burst, CB_LEN);
             }
         }
+        memcpy(s->burst, burst, CB_LEN);
     }
+    s->redo = redo;
+    s->redo_xo = xo;
+    s->redo_yo = yo;
+    s->redo_w = destw;
+    s->redo_h = desth;
 
-    for (y = 0; y < desth; y++) {
-        int field_offset;
-        int sy;
-        
-        field_offset = (s->field * s->h + desth) / desth / 2;
-        sy = (y * s->h) / desth;
-    
-        sy += field_offset;
+    mj.v = v;
+    mj.s = s;
+    mj.destw = destw;
+    mj.desth = desth;
+    mj.xo = xo;
+    mj.yo = yo;
+    mj.bpp = bpp;
+    mj.ph = ph;
+    mj.k = s->chroma_dec;
+    if (mj.k < 0) {
+        mj.k = 0;
+    }
+    if (mj.k > CRT_CHROMA_DEC_MAX) {
+        mj.k = CRT_CHROMA_DEC_MAX;
+    }
+    memcpy(mj.ccmodI, ccmodI, sizeof(ccmodI));
+    memcpy(mj.ccmodQ, ccmodQ, sizeof(ccmodQ));
+    n = crt_pool_size(pool);
+    mj.nbands = (n == 1) ? 1 : (n * CRT_POOL_BANDS);
+    if (mj.nbands > desth) {
+        mj.nbands = desth;
+    }
+    crt_pool_run(pool, mod_band, &mj, mj.nbands);
 
-        if (sy >= s->h) sy = s->h;
-        
-        sy *= s->w;
-        
-        reset_iir(&iirY);
-        reset_iir(&iirI);
-        reset_iir(&iirQ);
-        
-        for (x = 0; x < destw; x++) {
-            int fy, fi, fq;
-            int rA, gA, bA;
-            const unsigned char *pix;
-            int ire; /* composite signal */
-            int xoff;
-            
-            pix = s->data + ((((x * s->w) / destw) + sy) * bpp);
-            switch (s->format) {
-                case CRT_PIX_FORMAT_RGB:
-                case CRT_PIX_FORMAT_RGBA:
-                    rA = pix[0];
-                    gA = pix[1];
-                    bA = pix[2];
-                    break;
-                case CRT_PIX_FORMAT_BGR: 
-                case CRT_PIX_FORMAT_BGRA:
-                    rA = pix[2];
-                    gA = pix[1];
-                    bA = pix[0];
-                    break;
-                case CRT_PIX_FORMAT_ARGB:
-                    rA = pix[1];
-                    gA = pix[2];
-                    bA = pix[3];
-                    break;
-                case CRT_PIX_FORMAT_ABGR:
-                    rA = pix[3];
-                    gA = pix[2];
-                    bA = pix[1];
-                    break;
-                default:
-                    rA = gA = bA = 0;
-                    break;
+    /* an image that is too wide runs into the next lines, bottom up so
+     * a line that is marked here does not mark the ones after it too
+     */
+    if (xo + destw > CRT_HRES) {
+        for (y = desth - 1; y >= 0; y--) {
+            if (y + yo >= CRT_VRES || !v->dirty[y + yo]) {
+                continue;
+            }
+            for (n = y + yo + 1; n <= (xo + destw - 1) / CRT_HRES + y + yo; n++) {
+                if (n < CRT_VRES) {
+                    v->dirty[n] = 1;
+                }
             }
-
-            /* RGB to YIQ */
-            fy = (19595 * rA + 38470 * gA +  7471 * bA) >> 14;
-            fi = (39059 * rA - 18022 * gA - 21103 * bA) >> 14;
-            fq = (13894 * rA - 34275 * gA + 20382 * bA) >> 14;
-            ire = BLACK_LEVEL + v->black_point;
-            
-            xoff = (x + xo) % CRT_CC_SAMPLES;
-            /* bandlimit Y,I,Q */
-            fy = iirf(&iirY, fy);
-            fi = iirf(&iirI, fi) * ph * ccmodI[xoff] >> 4;
-            fq = iirf(&iirQ, fq) * ph * ccmodQ[xoff] >> 4;
-            ire += (fy + fi + fq) * (WHITE_LEVEL * v->white_point / 100) >> 10;
-            if (ire < 0)   ire = 0;
-            if (ire > 110) ire = 110;
-
-            v->analog[(x + xo) + (y + yo) * CRT_HRES] = ire;
         }
     }
+
     for (n = 0; n < CRT_CC_VPER; n++) {
         for (x = 0; x < CRT_CC_SAMPLES; x++) {
             v->ccf[n][x] = iccf[x] << 7;
         }
     }
 }
-#endif
+
+const struct CRT_SYS crt_sys_ntsc = {
+    CRT_SYSTEM_NTSC, "NTSC",
+    CRT_HRES, CRT_VRES,
+    CRT_TOP, CRT_BOT, CRT_LINES,
+    AV_BEG, AV_LEN,
+    SYNC_BEG,
+    CB_BEG, (CB_CYCLES * CRT_CB_FREQ),
+    CRT_CC_SAMPLES, CRT_CC_VPER,
+    L_FREQ,
+    BLACK_LEVEL, SYNC_LEVEL,
+    modulate
+};
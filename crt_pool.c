@@ -0,0 +1,251 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "crt_pool.h"
+#include "crt_thread.h"
+
+#include <stdlib.h>
+
+#if CRT_POOL_THREADS
+struct WORKER {
+    struct CRT_POOL *p;
+    int id;
+};
+#endif
+
+struct CRT_POOL {
+    int nthreads;
+    void *scratch[CRT_POOL_MAX]; /* see crt_pool_scratch() */
+    size_t scratch_size[CRT_POOL_MAX];
+#if CRT_POOL_THREADS
+    THREAD th[CRT_POOL_MAX];
+    struct WORKER w[CRT_POOL_MAX];
+    MUTEX mtx;
+    COND wake; /* signaled when a new batch of jobs is posted */
+    COND done; /* signaled when the last job of a batch finishes */
+    void (*fn)(void *ctx, int job, int worker);
+    void *ctx;
+    int njobs;
+    int next; /* next job to hand out */
+    int pending; /* jobs not yet finished */
+    int gen; /* incremented for each batch */
+    int quit;
+#endif
+};
+
+#if CRT_POOL_THREADS
+
+/* takes and runs jobs until none are left, must be called with mtx held */
+static void
+drain(struct CRT_POOL *p, int id)
+{
+    int job;
+
+    while (p->next < p->njobs) {
+        job = p->next++;
+        mutex_unlock(&p->mtx);
+        p->fn(p->ctx, job, id);
+        mutex_lock(&p->mtx);
+        if (--p->pending == 0) {
+            cond_signal(&p->done);
+        }
+    }
+}
+
+static void
+worker_loop(struct CRT_POOL *p, int id)
+{
+    int seen = 0;
+
+    mutex_lock(&p->mtx);
+    for (;;) {
+        while (p->gen == seen && !p->quit) {
+            cond_wait(&p->wake, &p->mtx);
+        }
+        if (p->quit) {
+            break;
+        }
+        seen = p->gen;
+        drain(p, id);
+    }
+    mutex_unlock(&p->mtx);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+worker_main(LPVOID arg)
+{
+    struct WORKER *w = arg;
+    worker_loop(w->p, w->id);
+    return 0;
+}
+#else
+static void *
+worker_main(void *arg)
+{
+    struct WORKER *w = arg;
+    worker_loop(w->p, w->id);
+    return NULL;
+}
+#endif
+
+static int
+ncpus(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int) si.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    return (int) sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    return 1;
+#endif
+}
+
+#endif
+
+extern struct CRT_POOL *
+crt_pool_create(int nthreads)
+{
+    struct CRT_POOL *p;
+#if CRT_POOL_THREADS
+    int i;
+#endif
+
+    p = calloc(1, sizeof(struct CRT_POOL));
+    if (p == NULL) {
+        return NULL;
+    }
+#if CRT_POOL_THREADS
+    if (nthreads <= 0) {
+        nthreads = ncpus();
+    }
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    if (nthreads > CRT_POOL_MAX) {
+        nthreads = CRT_POOL_MAX;
+    }
+    mutex_init(&p->mtx);
+    cond_init(&p->wake);
+    cond_init(&p->done);
+
+    /* the calling thread is worker 0 */
+    p->nthreads = 1;
+    for (i = 1; i < nthreads; i++) {
+        p->w[i].p = p;
+        p->w[i].id = i;
+#ifdef _WIN32
+        p->th[i] = CreateThread(NULL, 0, worker_main, &p->w[i], 0, NULL);
+        if (p->th[i] == NULL) {
+            break;
+        }
+#else
+        if (pthread_create(&p->th[i], NULL, worker_main, &p->w[i]) != 0) {
+            break;
+        }
+#endif
+        p->nthreads++;
+    }
+#else
+    p->nthreads = 1;
+#endif
+    return p;
+}
+
+extern void
+crt_pool_destroy(struct CRT_POOL *p)
+{
+    int i;
+
+    if (p == NULL) {
+        return;
+    }
+#if CRT_POOL_THREADS
+    mutex_lock(&p->mtx);
+    p->quit = 1;
+    cond_bcast(&p->wake);
+    mutex_unlock(&p->mtx);
+
+    for (i = 1; i < p->nthreads; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(p->th[i], INFINITE);
+        CloseHandle(p->th[i]);
+#else
+        pthread_join(p->th[i], NULL);
+#endif
+    }
+    cond_free(&p->wake);
+    cond_free(&p->done);
+    mutex_free(&p->mtx);
+#endif
+    for (i = 0; i < CRT_POOL_MAX; i++) {
+        free(p->scratch[i]);
+    }
+    free(p);
+}
+
+extern int
+crt_pool_size(struct CRT_POOL *p)
+{
+    if (p == NULL) {
+        return 1;
+    }
+    return p->nthreads;
+}
+
+extern void
+crt_pool_run(struct CRT_POOL *p,
+        void (*fn)(void *ctx, int job, int worker), void *ctx, int njobs)
+{
+    int i;
+
+#if CRT_POOL_THREADS
+    if (p != NULL && p->nthreads > 1 && njobs > 1) {
+        mutex_lock(&p->mtx);
+        p->fn = fn;
+        p->ctx = ctx;
+        p->njobs = njobs;
+        p->next = 0;
+        p->pending = njobs;
+        p->gen++;
+        cond_bcast(&p->wake);
+
+        drain(p, 0);
+        while (p->pending > 0) {
+            cond_wait(&p->done, &p->mtx);
+        }
+        mutex_unlock(&p->mtx);
+        return;
+    }
+#endif
+    for (i = 0; i < njobs; i++) {
+        fn(ctx, i, 0);
+    }
+}
+
+extern void *
+crt_pool_scratch(struct CRT_POOL *p, int worker, size_t size)
+{
+    if (p == NULL || worker < 0 || worker >= p->nthreads) {
+        return NULL;
+    }
+    if (p->scratch_size[worker] < size) {
+        free(p->scratch[worker]);
+        p->scratch[worker] = malloc(size);
+        p->scratch_size[worker] = (p->scratch[worker] == NULL) ? 0 : size;
+    }
+    return p->scratch[worker];
+}
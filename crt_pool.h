@@ -0,0 +1,75 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#ifndef _CRT_POOL_H_
+#define _CRT_POOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* crt_pool.h
+ *
+ * A small worker pool used by the multithreaded modulate/demodulate paths.
+ * Uses POSIX threads or the Win32 thread API.
+ *
+ */
+
+#include <stddef.h>
+
+/* 0 = no threads, every job runs on the calling thread */
+#ifndef CRT_POOL_THREADS
+#define CRT_POOL_THREADS 1
+#endif
+
+#define CRT_POOL_MAX 64 /* maximum number of threads in a pool */
+/* a field is split into this many bands per thread to even out the load */
+#define CRT_POOL_BANDS 4
+
+struct CRT_POOL;
+
+/* Creates a worker pool
+ *   nthreads - total number of threads including the calling thread,
+ *              0 or less means one per processor
+ *
+ * returns NULL if out of memory
+ */
+extern struct CRT_POOL *crt_pool_create(int nthreads);
+
+/* Stops the worker threads and frees the pool */
+extern void crt_pool_destroy(struct CRT_POOL *p);
+
+/* Get the total number of threads in the pool (always at least 1) */
+extern int crt_pool_size(struct CRT_POOL *p);
+
+/* Runs fn(ctx, job, worker) for job = 0 .. njobs - 1 and waits for all of
+ * them to finish. The calling thread takes part as worker 0, the others are
+ * numbered 1 .. crt_pool_size() - 1. Jobs may run in any order.
+ * Only one thread at a time may run jobs on a given pool.
+ *   p - the pool, may be NULL to run every job on the calling thread
+ */
+extern void crt_pool_run(struct CRT_POOL *p,
+        void (*fn)(void *ctx, int job, int worker), void *ctx, int njobs);
+
+/* Gets a buffer of at least size bytes that belongs to one worker, for
+ * what is too big for the stack of a worker thread. It is kept until the
+ * pool is destroyed, what is in it is lost when it has to grow.
+ * Only call it while no jobs run, or from a job for its own worker.
+ *   worker - 0 .. crt_pool_size() - 1
+ *
+ * returns NULL if out of memory or p is NULL
+ */
+extern void *crt_pool_scratch(struct CRT_POOL *p, int worker, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
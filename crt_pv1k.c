@@ -9,9 +9,12 @@
  */
 /*****************************************************************************/
 
+/* build this system no matter which one is the default */
+#undef CRT_SYSTEM
+#define CRT_SYSTEM CRT_SYSTEM_PV1K
 #include "crt_core.h"
+#include "crt_pool.h"
 
-#if (CRT_SYSTEM == CRT_SYSTEM_PV1K)
 #include <stdlib.h>
 #include <string.h>
 
@@ -22,7 +25,7 @@
 #define EXP_MUL(x, y) (((x) * (y)) >> EXP_P)
 #define EXP_DIV(x, y) (((x) << EXP_P) / (y))
 
-static int e11[] = {
+static const int e11[] = {
     EXP_ONE,
     5567,  /* e   */
     15133, /* e^2 */
@@ -79,12 +82,6 @@ expx(int n)
 /********************************* FILTERS ***********************************/
 /*****************************************************************************/
 
-/* infinite impulse response low pass filter for bandlimiting YIQ */
-static struct IIRLP {
-    int c;
-    int h; /* history */
-} iirY, iirI, iirQ;
-
 /* freq  - total bandwidth
  * limit - max frequency
  */
@@ -118,9 +115,222 @@ iirf(struct IIRLP *f, int s)
 #endif
 }
 
-extern void
-crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
+#define CB_LEN           (CB_CYCLES * CRT_CB_FREQ)
+/* lines with an hsync pulse and a color burst */
+#define VIDEO_LINE(n)    (!((n) >= 7 && (n) <= 9) && !VSYNC_LINE(n))
+/* lines that differ between the even and odd field */
+#define VSYNC_LINE(n)    ((n) >= 258 && (n) <= 260)
+
+/* writes the sync and blanking of a line, the color burst is left alone
+ * and so is the active video of the lines that can have an image.
+ * As long as v->analog does not get cleared this only has to be done
+ * once, after that only the lines that depend on the field are updated.
+ */
+static void
+blank_line(struct CRT *v, int n, int field)
+{
+    int t = LINE_BEG; /* time */
+    signed char *line = &v->analog[n * CRT_HRES];
+
+    if (n >= 7 && n <= 9) {
+        /* equalizing pulses - small blips of sync, mostly blank */
+        while (t < (4   * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
+        while (t < (50  * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+        while (t < (54  * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
+        while (t < (100 * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+    } else if (n >= 258 && n <= 260) {
+        int even[4] = { 46, 50, 96, 100 };
+        int odd[4] =  { 4, 50, 96, 100 };
+        int *offs = even;
+        if (field == 1) {
+            offs = odd;
+        }
+        /* vertical sync pulse - small blips of blank, mostly sync */
+        while (t < (offs[0] * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
+        while (t < (offs[1] * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+        while (t < (offs[2] * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
+        while (t < (offs[3] * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+    } else {
+        /* video line */
+        while (t < SYNC_BEG) line[t++] = BLANK_LEVEL; /* FP */
+        while (t < BW_BEG)   line[t++] = SYNC_LEVEL;  /* SYNC */
+        while (t < AV_BEG)   line[t++] = BLANK_LEVEL; /* BW + CB + BP */
+        if (n < CRT_TOP) {
+            while (t < CRT_HRES) line[t++] = BLANK_LEVEL;
+        }
+    }
+}
+
+/* horizontal source pixel of every modulated sample, only recomputed
+ * when the image width or the modulated width changes
+ */
+static void
+update_xmap(struct NTSC_SETTINGS *s, int destw)
+{
+    int x;
+
+    if (s->xmap_w == s->w && s->xmap_destw == destw) {
+        return;
+    }
+    for (x = 0; x < destw; x++) {
+        s->xmap[x] = (x * s->w) / destw;
+    }
+    s->xmap_w = s->w;
+    s->xmap_destw = destw;
+}
+
+/* reads the source pixels of one modulated line into R, G, B planes
+ *   src - first pixel of the source row
+ *   n   - number of samples
+ */
+static void
+read_row(const struct NTSC_SETTINGS *s, const unsigned char *src, int n,
+        int *r, int *g, int *b)
+{
+    const int *map = s->xmap;
+    int bpp = crt_bpp4fmt(s->format);
+    int ro, go, bo; /* byte offsets of the channels */
+    int x;
+
+    switch (s->format) {
+        case CRT_PIX_FORMAT_RGB:
+        case CRT_PIX_FORMAT_RGBA:
+            ro = 0;
+            go = 1;
+            bo = 2;
+            break;
+        case CRT_PIX_FORMAT_BGR: 
+        case CRT_PIX_FORMAT_BGRA:
+            ro = 2;
+            go = 1;
+            bo = 0;
+            break;
+        case CRT_PIX_FORMAT_ARGB:
+            ro = 1;
+            go = 2;
+            bo = 3;
+            break;
+        case CRT_PIX_FORMAT_ABGR:
+            ro = 3;
+            go = 2;
+            bo = 1;
+            break;
+        default:
+            return;
+    }
+    for (x = 0; x < n; x++) {
+        const unsigned char *pix = src + map[x] * bpp;
+        r[x] = pix[ro];
+        g[x] = pix[go];
+        b[x] = pix[bo];
+    }
+}
+
+/* what every band of active lines needs from modulate() */
+struct MOD_JOB {
+    struct CRT *v;
+    struct NTSC_SETTINGS *s;
+    int destw, desth;
+    int xo, yo;
+    int bpp;
+    int nbands;
+    int ccmodI[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for mod */
+    int ccmodQ[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for mod */
+};
+
+/* modulates one band of active lines, the IIR history is reset every line
+ * so the bands do not depend on each other
+ */
+static void
+mod_band(void *ctx, int job, int worker)
 {
+    struct MOD_JOB *mj = ctx;
+    struct CRT *v = mj->v;
+    struct NTSC_SETTINGS *s = mj->s;
+    struct IIRLP iirY, iirI, iirQ;
+    int destw = mj->destw;
+    int desth = mj->desth;
+    int xo = mj->xo;
+    int yo = mj->yo;
+    int ph;
+    int bpp = mj->bpp;
+    int (*ccmodI)[CRT_CC_SAMPLES] = mj->ccmodI;
+    int (*ccmodQ)[CRT_CC_SAMPLES] = mj->ccmodQ;
+    int r[AV_LEN], g[AV_LEN], b[AV_LEN]; /* source row */
+    signed char line[AV_LEN]; /* modulated row */
+    int x, y, y0, y1, n;
+
+    (void) worker;
+    iirY = s->iirY;
+    iirI = s->iirI;
+    iirQ = s->iirQ;
+    y0 = (job + 0) * desth / mj->nbands;
+    y1 = (job + 1) * desth / mj->nbands;
+
+    for (y = y0; y < y1; y++) {
+        int field_offset;
+        int sy;
+        
+        field_offset = (s->field * s->h + desth) / desth / 2;
+        sy = (y * s->h) / desth;
+    
+        sy += field_offset;
+
+        if (sy >= s->h) sy = s->h;
+        
+        sy *= s->w;
+        
+        read_row(s, s->data + sy * bpp, destw, r, g, b);
+        
+        reset_iir(&iirY);
+        reset_iir(&iirI);
+        reset_iir(&iirQ);
+        ph = (y + yo) % CRT_CC_VPER;
+        for (x = 0; x < destw; x++) {
+            int fy, fi, fq;
+            int rA, gA, bA;
+            int ire; /* composite signal */
+            int xoff;
+
+            rA = r[x];
+            gA = g[x];
+            bA = b[x];
+
+            /* RGB to YIQ */
+            fy = (19595 * rA + 38470 * gA +  7471 * bA) >> 14;
+            fi = (39059 * rA - 18022 * gA - 21103 * bA) >> 14;
+            fq = (13894 * rA - 34275 * gA + 20382 * bA) >> 14;
+            ire = BLACK_LEVEL + v->black_point;
+            
+            xoff = (x + xo) % CRT_CC_SAMPLES;
+            /* bandlimit Y,I,Q */
+            fy = iirf(&iirY, fy);
+            fi = iirf(&iirI, fi) * ccmodI[ph][xoff] >> 4;
+            fq = iirf(&iirQ, fq) * ccmodQ[ph][xoff] >> 4;
+            ire += (fy + fi + fq) * (WHITE_LEVEL * v->white_point / 100) >> 10;
+            if (ire < 0)   ire = 0;
+            if (ire > 110) ire = 110;
+
+            line[x] = ire;
+        }
+        /* only lines that came out different have to be decoded again */
+        n = xo + (y + yo) * CRT_HRES;
+        if (memcmp(&v->analog[n], line, destw) != 0) {
+            memcpy(&v->analog[n], line, destw);
+            /* only this band's own line, modulate() does the ones that
+             * an image that is too wide runs into
+             */
+            if (y + yo < CRT_VRES) {
+                v->dirty[y + yo] = 1;
+            }
+        }
+    }
+}
+
+static void
+modulate(struct CRT *v, struct NTSC_SETTINGS *s, struct CRT_POOL *pool)
+{
+    struct MOD_JOB mj;
     int x, y, xo, yo;
     int destw = AV_LEN;
     int desth = ((CRT_LINES * 64500) >> 16);
@@ -128,13 +338,15 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     int ccmodI[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for mod */
     int ccmodQ[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for mod */
     int ccburst[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for burst */
-    int sn, cs, n, ph;
+    signed char burst[CRT_CC_VPER][CB_LEN];
+    int sn, cs, n, t;
+    int new_burst = 0, redo = 0;
     int bpp;
 
     if (!s->iirs_initialized) {
-        init_iir(&iirY, L_FREQ, Y_FREQ);
-        init_iir(&iirI, L_FREQ, I_FREQ);
-        init_iir(&iirQ, L_FREQ, Q_FREQ);
+        init_iir(&s->iirY, L_FREQ, Y_FREQ);
+        init_iir(&s->iirI, L_FREQ, I_FREQ);
+        init_iir(&s->iirQ, L_FREQ, Q_FREQ);
         s->iirs_initialized = 1;
     }
 #if CRT_DO_BLOOM
@@ -187,6 +399,7 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     if (bpp == 0) {
         return; /* just to be safe */
     }
+    update_xmap(s, destw);
     xo = AV_BEG  + s->xoffset + (AV_LEN    - destw) / 2;
     yo = CRT_TOP + s->yoffset + (CRT_LINES - desth) / 2;
     
@@ -196,126 +409,119 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     /* align signal */
     xo = xo - (xo % CRT_CC_SAMPLES);
     
-    for (n = 0; n < CRT_VRES; n++) {
-        int t; /* time */
-        signed char *line = &v->analog[n * CRT_HRES];
-        
-        t = LINE_BEG;
-
-        if (n >= 7 && n <= 9) {
-            /* equalizing pulses - small blips of sync, mostly blank */
-            while (t < (4   * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
-            while (t < (50  * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
-            while (t < (54  * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
-            while (t < (100 * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
-        } else if (n >= 258 && n <= 260) {
-            int even[4] = { 46, 50, 96, 100 };
-            int odd[4] =  { 4, 50, 96, 100 };
-            int *offs = even;
-            if (s->field == 1) {
-                offs = odd;
-            }
-            /* vertical sync pulse - small blips of blank, mostly sync */
-            while (t < (offs[0] * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
-            while (t < (offs[1] * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
-            while (t < (offs[2] * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
-            while (t < (offs[3] * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
-        } else {
-            int cb;
-
-            /* video line */
-            while (t < SYNC_BEG) line[t++] = BLANK_LEVEL; /* FP */
-            while (t < BW_BEG)   line[t++] = SYNC_LEVEL;  /* SYNC */
-            while (t < AV_BEG)   line[t++] = BLANK_LEVEL; /* BW + CB + BP */
-            if (n < CRT_TOP) {
-                while (t < CRT_HRES) line[t++] = BLANK_LEVEL;
-            }
+    /* the image covers part of the sync or blanking,
+     * so all of it has to be written again next field
+     */
+    if (xo < AV_BEG || (xo + destw) > CRT_HRES ||
+        yo < CRT_TOP || (yo + desth) > CRT_VRES) {
+        redo = 1;
+    }
 
-            /* CB_CYCLES of color burst */
-            for (t = CB_BEG; t < CB_BEG + (CB_CYCLES * CRT_CB_FREQ); t++) {
-                cb = ccburst[n % CRT_CC_VPER][t % CRT_CC_SAMPLES];
-                line[t] = (BLANK_LEVEL + (cb * BURST_LEVEL)) >> 5;
-                iccf[(n + 3) % CRT_CC_VPER][t % CRT_CC_SAMPLES] = line[t];
-            }
+    /* CB_CYCLES of color burst, for each line of the vertical period */
+    for (y = 0; y < CRT_CC_VPER; y++) {
+        for (t = CB_BEG; t < CB_BEG + CB_LEN; t++) {
+            int cb = ccburst[y][t % CRT_CC_SAMPLES];
+            burst[y][t - CB_BEG] = (BLANK_LEVEL + (cb * BURST_LEVEL)) >> 5;
+            iccf[(y + 3) % CRT_CC_VPER][t % CRT_CC_SAMPLES] = burst[y][t - CB_BEG];
         }
     }
 
-    for (y = 0; y < desth; y++) {
-        int field_offset;
-        int sy;
-        
-        field_offset = (s->field * s->h + desth) / desth / 2;
-        sy = (y * s->h) / desth;
-    
-        sy += field_offset;
-
-        if (sy >= s->h) sy = s->h;
-        
-        sy *= s->w;
-        
-        reset_iir(&iirY);
-        reset_iir(&iirI);
-        reset_iir(&iirQ);
-        ph = (y + yo) % CRT_CC_VPER;
-        for (x = 0; x < destw; x++) {
-            int fy, fi, fq;
-            int rA, gA, bA;
-            const unsigned char *pix;
-            int ire; /* composite signal */
-            int xoff;
-
-            pix = s->data + ((((x * s->w) / destw) + sy) * bpp);
-            switch (s->format) {
-                case CRT_PIX_FORMAT_RGB:
-                case CRT_PIX_FORMAT_RGBA:
-                    rA = pix[0];
-                    gA = pix[1];
-                    bA = pix[2];
-                    break;
-                case CRT_PIX_FORMAT_BGR: 
-                case CRT_PIX_FORMAT_BGRA:
-                    rA = pix[2];
-                    gA = pix[1];
-                    bA = pix[0];
-                    break;
-                case CRT_PIX_FORMAT_ARGB:
-                    rA = pix[1];
-                    gA = pix[2];
-                    bA = pix[3];
-                    break;
-                case CRT_PIX_FORMAT_ABGR:
-                    rA = pix[3];
-                    gA = pix[2];
-                    bA = pix[1];
-                    break;
-                default:
-                    rA = gA = bA = 0;
-                    break;
+    /* the image overwrites the same part of the blanking every field,
+     * it only has to be written again when the image moved
+     */
+    if (s->redo && (s->redo_xo != xo || s->redo_yo != yo ||
+                    s->redo_w != destw || s->redo_h != desth)) {
+        s->field_initialized = 0;
+    }
+    /* the cached sync and blanking are only good for the CRT they
+     * were written to, and only while nothing else wrote over them
+     */
+    if (v->sig_owner != s || s->sig_crt != v) {
+        s->field_initialized = 0;
+    }
+    if (!s->field_initialized) {
+        for (n = 0; n < CRT_VRES; n++) {
+            blank_line(v, n, s->field);
+        }
+        memset(v->dirty, 1, sizeof(v->dirty));
+        s->blank_field = s->field;
+        s->field_initialized = 1;
+        s->sig_crt = v;
+        v->sig_owner = s;
+        new_burst = 1;
+    } else if (s->blank_field != s->field) {
+        for (n = 0; n < CRT_VRES; n++) {
+            if (VSYNC_LINE(n)) {
+                blank_line(v, n, s->field);
+                v->dirty[n] = 1;
             }
+        }
+        s->blank_field = s->field;
+    }
+    if (new_burst || memcmp(s->burst, burst, sizeof(burst)) != 0) {
+        for (n = 0; n < CRT_VRES; n++) {
+            if (VIDEO_LINE(n)) {
+                v->dirty[n] = 1;
+                memcpy(&v->analog[n * CRT_HRES + CB_BEG],
+                        burst[n % CRT_CC_VPER], CB_LEN);
+            }
+        }
+        memcpy(s->burst, burst, sizeof(burst));
+    }
+    s->redo = redo;
+    s->redo_xo = xo;
+    s->redo_yo = yo;
+    s->redo_w = destw;
+    s->redo_h = desth;
 
-            /* RGB to YIQ */
-            fy = (19595 * rA + 38470 * gA +  7471 * bA) >> 14;
-            fi = (39059 * rA - 18022 * gA - 21103 * bA) >> 14;
-            fq = (13894 * rA - 34275 * gA + 20382 * bA) >> 14;
-            ire = BLACK_LEVEL + v->black_point;
-            
-            xoff = (x + xo) % CRT_CC_SAMPLES;
-            /* bandlimit Y,I,Q */
-            fy = iirf(&iirY, fy);
-            fi = iirf(&iirI, fi) * ccmodI[ph][xoff] >> 4;
-            fq = iirf(&iirQ, fq) * ccmodQ[ph][xoff] >> 4;
-            ire += (fy + fi + fq) * (WHITE_LEVEL * v->white_point / 100) >> 10;
-            if (ire < 0)   ire = 0;
-            if (ire > 110) ire = 110;
+    mj.v = v;
+    mj.s = s;
+    mj.destw = destw;
+    mj.desth = desth;
+    mj.xo = xo;
+    mj.yo = yo;
+    mj.bpp = bpp;
+    memcpy(mj.ccmodI, ccmodI, sizeof(ccmodI));
+    memcpy(mj.ccmodQ, ccmodQ, sizeof(ccmodQ));
+    n = crt_pool_size(pool);
+    mj.nbands = (n == 1) ? 1 : (n * CRT_POOL_BANDS);
+    if (mj.nbands > desth) {
+        mj.nbands = desth;
+    }
+    crt_pool_run(pool, mod_band, &mj, mj.nbands);
 
-            v->analog[(x + xo) + (y + yo) * CRT_HRES] = ire;
+    /* an image that is too wide runs into the next lines, bottom up so
+     * a line that is marked here does not mark the ones after it too
+     */
+    if (xo + destw > CRT_HRES) {
+        for (y = desth - 1; y >= 0; y--) {
+            if (y + yo >= CRT_VRES || !v->dirty[y + yo]) {
+                continue;
+            }
+            for (n = y + yo + 1; n <= (xo + destw - 1) / CRT_HRES + y + yo; n++) {
+                if (n < CRT_VRES) {
+                    v->dirty[n] = 1;
+                }
+            }
         }
     }
-    
+
     for (n = 0; n < CRT_CC_VPER; n++) {
         for (x = 0; x < CRT_CC_SAMPLES; x++) {
             v->ccf[n][x] = iccf[n][x] << 7;
         }
     }
 }
-#endif
+
+const struct CRT_SYS crt_sys_pv1k = {
+    CRT_SYSTEM_PV1K, "PV-1000",
+    CRT_HRES, CRT_VRES,
+    CRT_TOP, CRT_BOT, CRT_LINES,
+    AV_BEG, AV_LEN,
+    SYNC_BEG,
+    CB_BEG, (CB_CYCLES * CRT_CB_FREQ),
+    CRT_CC_SAMPLES, CRT_CC_VPER,
+    L_FREQ,
+    BLACK_LEVEL, SYNC_LEVEL,
+    modulate
+};
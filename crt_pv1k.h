@@ -101,6 +101,12 @@ extern "C" {
 #define BLANK_LEVEL      0
 #define SYNC_LEVEL      -40
 
+/* infinite impulse response low pass filter for bandlimiting YIQ */
+struct IIRLP {
+    int c;
+    int h; /* history */
+};
+
 struct NTSC_SETTINGS {
     const unsigned char *data; /* image data */
     int format;     /* pix format (one of the CRT_PIX_FORMATs in crt_core.h) */
@@ -115,6 +121,19 @@ struct NTSC_SETTINGS {
     int dot_crawl_offset; /* 0-5 */
     /* make sure your NTSC_SETTINGS struct is zeroed out before you do anything */
     int iirs_initialized; /* internal state */
+    struct IIRLP iirY, iirI, iirQ; /* internal state */
+    int xmap[AV_LEN]; /* internal state, source pixel of every sample */
+    int xmap_w, xmap_destw; /* internal state */
+    /* sync and blanking are in the CRT's analog signal,
+     * set to 0 if you clear or change the analog signal yourself.
+     * crt_init and crt_init_sys clear it for you.
+     */
+    int field_initialized; /* internal state */
+    const struct CRT *sig_crt; /* internal state, CRT the above is for */
+    int blank_field; /* internal state */
+    /* internal state, where the last image that ran into the blanking was */
+    int redo, redo_xo, redo_yo, redo_w, redo_h;
+    signed char burst[CRT_CC_VPER][CB_CYCLES * CRT_CB_FREQ]; /* internal state */
 };
 
 #ifdef __cplusplus
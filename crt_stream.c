@@ -0,0 +1,330 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "crt_core.h"
+#include "crt_stream.h"
+#include "crt_thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* a buffer of the ring and what a modulator hands on with it */
+struct FIELD {
+    signed char *analog;
+    unsigned seq; /* number of the field in analog, 0 if not known */
+    int ccf[CRT_MAX_CC_VPER][CRT_MAX_CC_SAMPLES];
+    unsigned char dirty[CRT_MAX_VRES];
+};
+
+struct CRT_STREAM {
+    const struct CRT_SYS *sys;
+    int size; /* samples in a field */
+    int n; /* fields in the ring */
+    struct FIELD *f;
+    int rd; /* oldest field */
+    int count; /* fields that were submitted but not acquired */
+    int closed;
+    /* the buffers lent to the modulating and the demodulating CRT,
+     * every buffer is either in the ring or lent to one of them
+     */
+    struct CRT *m, *v;
+    signed char *mbuf, *vbuf;
+    unsigned vseq; /* field in vbuf */
+    /* only touched by the submitting side */
+    unsigned seq; /* number of the last field submitted */
+    unsigned changed[CRT_MAX_VRES]; /* field each line last changed in */
+#if CRT_POOL_THREADS
+    MUTEX mtx;
+    COND added; /* signaled when a field is submitted */
+    COND freed; /* signaled when a field is acquired */
+#endif
+};
+
+static void
+lock(struct CRT_STREAM *st)
+{
+#if CRT_POOL_THREADS
+    mutex_lock(&st->mtx);
+#else
+    (void) st;
+#endif
+}
+
+static void
+unlock(struct CRT_STREAM *st)
+{
+#if CRT_POOL_THREADS
+    mutex_unlock(&st->mtx);
+#else
+    (void) st;
+#endif
+}
+
+/* whether field c came after field s, the numbers wrap around */
+static int
+after(unsigned c, unsigned s)
+{
+    return c != s && ((c - s) & 0xffffffffUL) < 0x80000000UL;
+}
+
+/* gives a CRT its own buffer back with the signal it had */
+static void
+give_back(struct CRT_STREAM *st, struct CRT *c, signed char *buf)
+{
+    if (c != NULL && c->analog == buf) {
+        memcpy(c->analog_buf, buf, st->size);
+        c->analog = c->analog_buf;
+    }
+}
+
+extern struct CRT_STREAM *
+crt_stream_create(int system, int nfields)
+{
+    struct CRT_STREAM *st;
+    const struct CRT_SYS *sys;
+    int i;
+
+    sys = crt_get_sys(system);
+    if (sys == NULL) {
+        return NULL;
+    }
+    if (nfields < 1) {
+        nfields = 1;
+    }
+    st = calloc(1, sizeof(struct CRT_STREAM));
+    if (st == NULL) {
+        return NULL;
+    }
+    st->sys = sys;
+    st->size = sys->hres * sys->vres;
+    st->n = nfields;
+    st->f = calloc(nfields, sizeof(struct FIELD));
+    if (st->f == NULL) {
+        free(st);
+        return NULL;
+    }
+    st->mbuf = malloc(st->size);
+    st->vbuf = malloc(st->size);
+    for (i = 0; i < nfields; i++) {
+        st->f[i].analog = malloc(st->size);
+    }
+    for (i = 0; i < nfields; i++) {
+        if (st->f[i].analog == NULL) {
+            break;
+        }
+    }
+    if (i < nfields || st->mbuf == NULL || st->vbuf == NULL) {
+        for (i = 0; i < nfields; i++) {
+            free(st->f[i].analog);
+        }
+        free(st->mbuf);
+        free(st->vbuf);
+        free(st->f);
+        free(st);
+        return NULL;
+    }
+#if CRT_POOL_THREADS
+    mutex_init(&st->mtx);
+    cond_init(&st->added);
+    cond_init(&st->freed);
+#endif
+    return st;
+}
+
+extern void
+crt_stream_destroy(struct CRT_STREAM *st)
+{
+    int i;
+
+    if (st == NULL) {
+        return;
+    }
+#if CRT_POOL_THREADS
+    cond_free(&st->added);
+    cond_free(&st->freed);
+    mutex_free(&st->mtx);
+#endif
+    give_back(st, st->m, st->mbuf);
+    give_back(st, st->v, st->vbuf);
+    for (i = 0; i < st->n; i++) {
+        free(st->f[i].analog);
+    }
+    free(st->mbuf);
+    free(st->vbuf);
+    free(st->f);
+    free(st);
+}
+
+extern int
+crt_stream_submit(struct CRT_STREAM *st, struct CRT *m, int wait)
+{
+    struct FIELD *f;
+    signed char *buf;
+    unsigned seq;
+    int i, hres;
+
+    if (m->sys != st->sys) {
+        return -1;
+    }
+    lock(st);
+#if CRT_POOL_THREADS
+    while (wait && !st->closed && st->count == st->n) {
+        cond_wait(&st->freed, &st->mtx);
+    }
+#else
+    (void) wait;
+#endif
+    if (st->closed) {
+        unlock(st);
+        return -1;
+    }
+    if (st->count == st->n) {
+        unlock(st);
+        return 0;
+    }
+    /* nobody else touches the buffer after the last submitted one */
+    f = &st->f[(st->rd + st->count) % st->n];
+    unlock(st);
+
+    /* a CRT that is new to the stream or was initialized again moves
+     * into the stream's buffer, nothing is known about what it had before
+     */
+    if (m != st->m || m->analog != st->mbuf) {
+        give_back(st, st->m, st->mbuf);
+        memcpy(st->mbuf, m->analog, st->size);
+        m->analog = st->mbuf;
+        memset(m->dirty, 1, sizeof(m->dirty));
+        st->m = m;
+    }
+    seq = ++st->seq;
+    if (seq == 0) {
+        seq = st->seq = 1; /* 0 is a field that is not known */
+    }
+    for (i = 0; i < st->sys->vres; i++) {
+        if (m->dirty[i]) {
+            st->changed[i] = seq;
+        }
+    }
+    /* the field goes into the ring as is, the CRT gets the older field
+     * that was in the buffer and only the lines that changed since that
+     * one are copied over, so it goes on from this field
+     */
+    buf = f->analog;
+    f->analog = m->analog;
+    m->analog = buf;
+    st->mbuf = buf;
+    hres = st->sys->hres;
+    for (i = 0; i < st->sys->vres; i++) {
+        if (f->seq == 0 || after(st->changed[i], f->seq)) {
+            memcpy(buf + i * hres, f->analog + i * hres, hres);
+        }
+    }
+    f->seq = seq;
+    memcpy(f->ccf, m->ccf, sizeof(f->ccf));
+    memcpy(f->dirty, m->dirty, sizeof(f->dirty));
+    /* handed on, the next field starts over */
+    memset(m->dirty, 0, sizeof(m->dirty));
+
+    lock(st);
+    st->count++;
+#if CRT_POOL_THREADS
+    cond_signal(&st->added);
+#endif
+    unlock(st);
+    return 1;
+}
+
+extern int
+crt_stream_acquire(struct CRT_STREAM *st, struct CRT *v, int wait)
+{
+    struct FIELD *f;
+    signed char *buf;
+    unsigned seq;
+    int i;
+
+    if (v->sys != st->sys) {
+        return -1;
+    }
+    lock(st);
+#if CRT_POOL_THREADS
+    while (wait && !st->closed && st->count == 0) {
+        cond_wait(&st->added, &st->mtx);
+    }
+#else
+    (void) wait;
+#endif
+    if (st->count == 0) {
+        i = st->closed ? -1 : 0;
+        unlock(st);
+        return i;
+    }
+    f = &st->f[st->rd];
+    unlock(st);
+
+    /* a CRT that is new to the stream or was initialized again
+     * decodes every line of its first field
+     */
+    if (v != st->v || v->analog != st->vbuf) {
+        give_back(st, st->v, st->vbuf);
+        v->analog = st->vbuf;
+        st->vseq = 0;
+        memset(v->dirty, 1, sizeof(v->dirty));
+        st->v = v;
+    }
+    /* the CRT gets the field, its previous one goes back into the ring */
+    buf = f->analog;
+    f->analog = v->analog;
+    v->analog = buf;
+    st->vbuf = buf;
+    seq = f->seq;
+    f->seq = st->vseq;
+    st->vseq = seq;
+    memcpy(v->ccf, f->ccf, sizeof(v->ccf));
+    /* lines of fields that were acquired but not decoded stay changed */
+    for (i = 0; i < st->sys->vres; i++) {
+        v->dirty[i] |= f->dirty[i];
+    }
+
+    lock(st);
+    st->rd = (st->rd + 1) % st->n;
+    st->count--;
+#if CRT_POOL_THREADS
+    cond_signal(&st->freed);
+#endif
+    unlock(st);
+    return 1;
+}
+
+extern int
+crt_stream_pending(struct CRT_STREAM *st)
+{
+    int n;
+
+    lock(st);
+    n = st->count;
+    unlock(st);
+    return n;
+}
+
+extern void
+crt_stream_close(struct CRT_STREAM *st)
+{
+    lock(st);
+    st->closed = 1;
+#if CRT_POOL_THREADS
+    cond_bcast(&st->added);
+    cond_bcast(&st->freed);
+#endif
+    unlock(st);
+}
@@ -0,0 +1,102 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#ifndef _CRT_STREAM_H_
+#define _CRT_STREAM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* crt_stream.h
+ *
+ * A ring of analog fields between a thread that modulates and a thread
+ * that demodulates, so field N + 1 can be modulated while field N is
+ * being decoded.
+ *
+ * Each side has its own CRT of the same system. The modulating one only
+ * ever gets crt_modulate() calls (it keeps the sync and blanking the
+ * modulators leave in v->analog between fields), every field it makes is
+ * handed to the stream with crt_stream_submit(). The demodulating one gets
+ * the fields in order with crt_stream_acquire() and decodes them with
+ * crt_demodulate() as usual.
+ *
+ *   modulating thread:                 demodulating thread:
+ *     crt_modulate(&mcrt, &ntsc);        while (crt_stream_acquire(st, &crt, 1) > 0) {
+ *     crt_stream_submit(st, &mcrt, 1);       crt_demodulate(&crt, noise);
+ *                                            ...show it...
+ *                                        }
+ *
+ * The modulating side can be at most the number of buffers in the ring
+ * ahead, so with 2 or 3 buffers a 60 Hz pipeline shows a field at most
+ * that many fields after it was made.
+ *
+ * Fields are not copied, the CRTs on both sides are lent buffers of the
+ * stream (v->analog points at them) and trade them for the ones in the
+ * ring. The modulating CRT gets back an older field, only the lines that
+ * changed since then are copied into it. A CRT that used the stream gets
+ * its own buffer back when another CRT takes its place on that side or
+ * the stream is destroyed, so it has to stay around until then.
+ */
+
+struct CRT;
+struct CRT_STREAM;
+
+/* Creates a stream
+ *   system  - CRT_SYSTEM_ of the CRTs on both sides
+ *   nfields - number of field buffers in the ring, at least 1
+ *
+ * returns NULL if out of memory or the system does not exist
+ */
+extern struct CRT_STREAM *crt_stream_create(int system, int nfields);
+
+/* Frees the stream, nothing may be waiting on it.
+ * The CRTs that use it get their own buffers back.
+ */
+extern void crt_stream_destroy(struct CRT_STREAM *st);
+
+/* Hands the field that was just modulated into m on to the ring.
+ * The lines m marked as changed are handed on to the demodulating side.
+ *   wait - if the ring is full, 1 = wait for a free buffer, 0 = return
+ *
+ * returns 1 if the field was added, 0 if the ring is full and wait is 0,
+ *        -1 if the stream was closed or m is not of the stream's system
+ */
+extern int crt_stream_submit(struct CRT_STREAM *st, struct CRT *m, int wait);
+
+/* Hands the oldest field in the ring to v, crt_demodulate(v, ...) then
+ * decodes it. The field v had before goes back into the ring.
+ * Do not write to v->analog, the modulating side gets the buffer again.
+ *   wait - if the ring is empty, 1 = wait for a field, 0 = return
+ *
+ * returns 1 if v got a field, 0 if the ring is empty and wait is 0,
+ *        -1 if the stream was closed and every field was taken or
+ *        v is not of the stream's system
+ */
+extern int crt_stream_acquire(struct CRT_STREAM *st, struct CRT *v, int wait);
+
+/* Number of fields in the ring that were not acquired yet */
+extern int crt_stream_pending(struct CRT_STREAM *st);
+
+/* Closes the stream, waiting and later crt_stream_submit() calls return -1,
+ * crt_stream_acquire() returns the fields that are left and then -1.
+ */
+extern void crt_stream_close(struct CRT_STREAM *st);
+
+/* Only one thread at a time may submit and only one may acquire.
+ * Without threads (CRT_POOL_THREADS 0 in crt_pool.h) nothing waits,
+ * wait is taken as 0.
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,9 +9,13 @@
  */
 /*****************************************************************************/
 
+/* CRT_SYSTEM_TEMP gets defined once this system is added to crt_core.h */
+#ifdef CRT_SYSTEM_TEMP
+#undef CRT_SYSTEM
+#define CRT_SYSTEM CRT_SYSTEM_TEMP
 #include "crt_core.h"
+#include "crt_pool.h"
 
-#if (CRT_SYSTEM == CRT_SYSTEM_TEMP)
 #include <stdlib.h>
 #include <string.h>
 
@@ -22,7 +26,7 @@
 #define EXP_MUL(x, y) (((x) * (y)) >> EXP_P)
 #define EXP_DIV(x, y) (((x) << EXP_P) / (y))
 
-static int e11[] = {
+static const int e11[] = {
     EXP_ONE,
     5567,  /* e   */
     15133, /* e^2 */
@@ -79,12 +83,6 @@ expx(int n)
 /********************************* FILTERS ***********************************/
 /*****************************************************************************/
 
-/* infinite impulse response low pass filter for bandlimiting YIQ */
-static struct IIRLP {
-    int c;
-    int h; /* history */
-} iirY, iirI, iirQ;
-
 /* freq  - total bandwidth
  * limit - max frequency
  */
@@ -122,9 +120,172 @@ iirf(struct IIRLP *f, int s)
 #endif
 }
 
-extern void
-crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
+/* horizontal source pixel of every modulated sample, only recomputed
+ * when the image width or the modulated width changes
+ */
+static void
+update_xmap(struct NTSC_SETTINGS *s, int destw)
+{
+    int x;
+
+    if (s->xmap_w == s->w && s->xmap_destw == destw) {
+        return;
+    }
+    for (x = 0; x < destw; x++) {
+        s->xmap[x] = (x * s->w) / destw;
+    }
+    s->xmap_w = s->w;
+    s->xmap_destw = destw;
+}
+
+/* reads the source pixels of one modulated line into R, G, B planes
+ *   src - first pixel of the source row
+ *   n   - number of samples
+ */
+static void
+read_row(const struct NTSC_SETTINGS *s, const unsigned char *src, int n,
+        int *r, int *g, int *b)
+{
+    const int *map = s->xmap;
+    int bpp = crt_bpp4fmt(s->format);
+    int ro, go, bo; /* byte offsets of the channels */
+    int x;
+
+    switch (s->format) {
+        case CRT_PIX_FORMAT_RGB:
+        case CRT_PIX_FORMAT_RGBA:
+            ro = 0;
+            go = 1;
+            bo = 2;
+            break;
+        case CRT_PIX_FORMAT_BGR: 
+        case CRT_PIX_FORMAT_BGRA:
+            ro = 2;
+            go = 1;
+            bo = 0;
+            break;
+        case CRT_PIX_FORMAT_ARGB:
+            ro = 1;
+            go = 2;
+            bo = 3;
+            break;
+        case CRT_PIX_FORMAT_ABGR:
+            ro = 3;
+            go = 2;
+            bo = 1;
+            break;
+        default:
+            return;
+    }
+    for (x = 0; x < n; x++) {
+        const unsigned char *pix = src + map[x] * bpp;
+        r[x] = pix[ro];
+        g[x] = pix[go];
+        b[x] = pix[bo];
+    }
+}
+
+/* what every band of active lines needs from modulate() */
+struct MOD_JOB {
+    struct CRT *v;
+    struct NTSC_SETTINGS *s;
+    int destw, desth;
+    int xo, yo;
+    int bpp;
+    int nbands;
+    int ccmodI[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for mod */
+    int ccmodQ[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for mod */
+};
+
+/* modulates one band of active lines, the IIR history is reset every line
+ * so the bands do not depend on each other
+ */
+static void
+mod_band(void *ctx, int job, int worker)
+{
+    struct MOD_JOB *mj = ctx;
+    struct CRT *v = mj->v;
+    struct NTSC_SETTINGS *s = mj->s;
+    struct IIRLP iirY, iirI, iirQ;
+    int destw = mj->destw;
+    int desth = mj->desth;
+    int xo = mj->xo;
+    int yo = mj->yo;
+    int ph;
+    int bpp = mj->bpp;
+    int (*ccmodI)[CRT_CC_SAMPLES] = mj->ccmodI;
+    int (*ccmodQ)[CRT_CC_SAMPLES] = mj->ccmodQ;
+    int r[AV_LEN], g[AV_LEN], b[AV_LEN]; /* source row */
+    int x, y, y0, y1;
+
+    (void) worker;
+    iirY = s->iirY;
+    iirI = s->iirI;
+    iirQ = s->iirQ;
+    y0 = (job + 0) * desth / mj->nbands;
+    y1 = (job + 1) * desth / mj->nbands;
+
+    for (y = y0; y < y1; y++) {
+        int field_offset;
+        int sy;
+        
+        field_offset = (s->field * s->h + desth) / desth / 2;
+        sy = (y * s->h) / desth;
+    
+        sy += field_offset;
+
+        if (sy >= s->h) sy = s->h;
+        
+        sy *= s->w;
+        
+        read_row(s, s->data + sy * bpp, destw, r, g, b);
+        
+        reset_iir(&iirY);
+        reset_iir(&iirI);
+        reset_iir(&iirQ);
+        
+        ph = (y + yo) % CRT_CC_VPER;
+        
+        for (x = 0; x < destw; x++) {
+            int fy, fi, fq;
+            int rA, gA, bA;
+            int ire; /* composite signal */
+            int xoff;
+            /* RGB to YIQ matrix in 16.16 fixed point format */
+            static int yiqmat[9] = {
+                19595,  38470,  7471,   /* Y */
+                39059, -18022, -21103,  /* I */
+                13894, -34275,  20382,  /* Q */
+            };
+            rA = r[x];
+            gA = g[x];
+            bA = b[x];
+
+            /* RGB to YIQ */
+            fy = (yiqmat[0] * rA + yiqmat[1] * gA + yiqmat[2] * bA) >> 14;
+            fi = (yiqmat[3] * rA + yiqmat[4] * gA + yiqmat[5] * bA) >> 14;
+            fq = (yiqmat[6] * rA + yiqmat[7] * gA + yiqmat[8] * bA) >> 14;
+            ire = BLACK_LEVEL + v->black_point;
+            
+            xoff = (x + xo) % CRT_CC_SAMPLES;
+            /* bandlimit Y,I,Q */
+            fy = iirf(&iirY, fy);
+            fi = iirf(&iirI, fi) * ccmodI[ph][xoff] >> 4;
+            fq = iirf(&iirQ, fq) * ccmodQ[ph][xoff] >> 4;
+            /* modulate as (Y + sin(x) * I + cos(x) * Q) */
+            ire += (fy + fi + fq) * (WHITE_LEVEL * v->white_point / 100) >> 10;
+            if (ire < IRE_MIN) ire = IRE_MIN;
+            if (ire > IRE_MAX) ire = IRE_MAX;
+
+            v->analog[(x + xo) + (y + yo) * CRT_HRES] = ire;
+        }
+    }
+}
+
+static void
+modulate(struct CRT *v, struct NTSC_SETTINGS *s, struct CRT_POOL *pool)
 {
+    struct MOD_JOB mj;
     int x, y, xo, yo;
     int destw = AV_LEN;
     int desth = ((CRT_LINES * 64500) >> 16);
@@ -132,13 +293,16 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     int ccmodI[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for mod */
     int ccmodQ[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for mod */
     int ccburst[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for burst */
-    int sn, cs, n, ph;
+    int sn, cs, n;
     int bpp;
 
+    /* lines are not tracked, any of them may have changed */
+    memset(v->dirty, 1, sizeof(v->dirty));
+
     if (!s->iirs_initialized) {
-        init_iir(&iirY, L_FREQ, Y_FREQ);
-        init_iir(&iirI, L_FREQ, I_FREQ);
-        init_iir(&iirQ, L_FREQ, Q_FREQ);
+        init_iir(&s->iirY, L_FREQ, Y_FREQ);
+        init_iir(&s->iirI, L_FREQ, I_FREQ);
+        init_iir(&s->iirQ, L_FREQ, Q_FREQ);
         s->iirs_initialized = 1;
     }
 #if CRT_DO_BLOOM
@@ -191,6 +355,7 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     if (bpp == 0) {
         return; /* just to be safe */
     }
+    update_xmap(s, destw);
     xo = AV_BEG  + s->xoffset + (AV_LEN    - destw) / 2;
     yo = CRT_TOP + s->yoffset + (CRT_LINES - desth) / 2;
     
@@ -248,85 +413,22 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
         }
     }
 
-    for (y = 0; y < desth; y++) {
-        int field_offset;
-        int sy;
-        
-        field_offset = (s->field * s->h + desth) / desth / 2;
-        sy = (y * s->h) / desth;
-    
-        sy += field_offset;
-
-        if (sy >= s->h) sy = s->h;
-        
-        sy *= s->w;
-        
-        reset_iir(&iirY);
-        reset_iir(&iirI);
-        reset_iir(&iirQ);
-        
-        ph = (y + yo) % CRT_CC_VPER;
-        
-        for (x = 0; x < destw; x++) {
-            int fy, fi, fq;
-            int rA, gA, bA;
-            const unsigned char *pix;
-            int ire; /* composite signal */
-            int xoff;
-            /* RGB to YIQ matrix in 16.16 fixed point format */
-            static int yiqmat[9] = {
-                19595,  38470,  7471,   /* Y */
-                39059, -18022, -21103,  /* I */
-                13894, -34275,  20382,  /* Q */
-            };
-            pix = s->data + ((((x * s->w) / destw) + sy) * bpp);
-            switch (s->format) {
-                case CRT_PIX_FORMAT_RGB:
-                case CRT_PIX_FORMAT_RGBA:
-                    rA = pix[0];
-                    gA = pix[1];
-                    bA = pix[2];
-                    break;
-                case CRT_PIX_FORMAT_BGR: 
-                case CRT_PIX_FORMAT_BGRA:
-                    rA = pix[2];
-                    gA = pix[1];
-                    bA = pix[0];
-                    break;
-                case CRT_PIX_FORMAT_ARGB:
-                    rA = pix[1];
-                    gA = pix[2];
-                    bA = pix[3];
-                    break;
-                case CRT_PIX_FORMAT_ABGR:
-                    rA = pix[3];
-                    gA = pix[2];
-                    bA = pix[1];
-                    break;
-                default:
-                    rA = gA = bA = 0;
-                    break;
-            }
-
-            /* RGB to YIQ */
-            fy = (yiqmat[0] * rA + yiqmat[1] * gA + yiqmat[2] * bA) >> 14;
-            fi = (yiqmat[3] * rA + yiqmat[4] * gA + yiqmat[5] * bA) >> 14;
-            fq = (yiqmat[6] * rA + yiqmat[7] * gA + yiqmat[8] * bA) >> 14;
-            ire = BLACK_LEVEL + v->black_point;
-            
-            xoff = (x + xo) % CRT_CC_SAMPLES;
-            /* bandlimit Y,I,Q */
-            fy = iirf(&iirY, fy);
-            fi = iirf(&iirI, fi) * ccmodI[ph][xoff] >> 4;
-            fq = iirf(&iirQ, fq) * ccmodQ[ph][xoff] >> 4;
-            /* modulate as (Y + sin(x) * I + cos(x) * Q) */
-            ire += (fy + fi + fq) * (WHITE_LEVEL * v->white_point / 100) >> 10;
-            if (ire < IRE_MIN) ire = IRE_MIN;
-            if (ire > IRE_MAX) ire = IRE_MAX;
-
-            v->analog[(x + xo) + (y + yo) * CRT_HRES] = ire;
-        }
+    mj.v = v;
+    mj.s = s;
+    mj.destw = destw;
+    mj.desth = desth;
+    mj.xo = xo;
+    mj.yo = yo;
+    mj.bpp = bpp;
+    memcpy(mj.ccmodI, ccmodI, sizeof(ccmodI));
+    memcpy(mj.ccmodQ, ccmodQ, sizeof(ccmodQ));
+    n = crt_pool_size(pool);
+    mj.nbands = (n == 1) ? 1 : (n * CRT_POOL_BANDS);
+    if (mj.nbands > desth) {
+        mj.nbands = desth;
     }
+    crt_pool_run(pool, mod_band, &mj, mj.nbands);
+
     /* this generally does not need to be touched */
     for (n = 0; n < CRT_CC_VPER; n++) {
         for (x = 0; x < CRT_CC_SAMPLES; x++) {
@@ -334,4 +436,18 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
         }
     }
 }
+
+
+const struct CRT_SYS crt_sys_temp = {
+    CRT_SYSTEM_TEMP, "Template",
+    CRT_HRES, CRT_VRES,
+    CRT_TOP, CRT_BOT, CRT_LINES,
+    AV_BEG, AV_LEN,
+    SYNC_BEG,
+    CB_BEG, (CB_CYCLES * CRT_CB_FREQ),
+    CRT_CC_SAMPLES, CRT_CC_VPER,
+    L_FREQ,
+    BLACK_LEVEL, SYNC_LEVEL,
+    modulate
+};
 #endif
@@ -23,7 +23,8 @@ extern "C" {
 
 /* NOTE: to add this to the main library, simply add it to the list at the 
  * top of crt_core.h and add its header include as another elif clause,
- * that's it!
+ * declare its CRT_SYS next to crt_sys_ntsc and return it from crt_get_sys()
+ * in crt_core.c, that's it!
  */
 
 /* define number of chroma cycles per line
@@ -145,6 +146,12 @@ extern "C" {
 #define EQU_REGION_B_LO 7
 #define EQU_REGION_B_HI 9
 
+/* infinite impulse response low pass filter for bandlimiting YIQ */
+struct IIRLP {
+    int c;
+    int h; /* history */
+};
+
 /* your NTSC_SETTINGS struct, add or remove data as you see fit */
 struct NTSC_SETTINGS {
     const unsigned char *data; /* image data */
@@ -160,6 +167,9 @@ struct NTSC_SETTINGS {
     int dot_crawl_offset; /* 0-5 */
     /* make sure your NTSC_SETTINGS struct is zeroed out before you do anything */
     int iirs_initialized; /* internal state */
+    struct IIRLP iirY, iirI, iirQ; /* internal state */
+    int xmap[AV_LEN]; /* internal state, source pixel of every sample */
+    int xmap_w, xmap_destw; /* internal state */
 };
 
 #ifdef __cplusplus
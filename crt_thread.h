@@ -0,0 +1,57 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#ifndef _CRT_THREAD_H_
+#define _CRT_THREAD_H_
+
+/* crt_thread.h
+ *
+ * Mutexes, condition variables and threads on top of POSIX threads or the
+ * Win32 thread API, shared by crt_pool.c and crt_stream.c.
+ * Only defined when CRT_POOL_THREADS is on (see crt_pool.h).
+ *
+ */
+
+#include "crt_pool.h"
+
+#if CRT_POOL_THREADS
+#ifdef _WIN32
+#include <windows.h>
+#define MUTEX            CRITICAL_SECTION
+#define COND             CONDITION_VARIABLE
+#define THREAD           HANDLE
+#define mutex_init(m)    InitializeCriticalSection(m)
+#define mutex_free(m)    DeleteCriticalSection(m)
+#define mutex_lock(m)    EnterCriticalSection(m)
+#define mutex_unlock(m)  LeaveCriticalSection(m)
+#define cond_init(c)     InitializeConditionVariable(c)
+#define cond_free(c)
+#define cond_wait(c, m)  SleepConditionVariableCS(c, m, INFINITE)
+#define cond_signal(c)   WakeConditionVariable(c)
+#define cond_bcast(c)    WakeAllConditionVariable(c)
+#else
+#include <pthread.h>
+#include <unistd.h>
+#define MUTEX            pthread_mutex_t
+#define COND             pthread_cond_t
+#define THREAD           pthread_t
+#define mutex_init(m)    pthread_mutex_init(m, NULL)
+#define mutex_free(m)    pthread_mutex_destroy(m)
+#define mutex_lock(m)    pthread_mutex_lock(m)
+#define mutex_unlock(m)  pthread_mutex_unlock(m)
+#define cond_init(c)     pthread_cond_init(c, NULL)
+#define cond_free(c)     pthread_cond_destroy(c)
+#define cond_wait(c, m)  pthread_cond_wait(c, m)
+#define cond_signal(c)   pthread_cond_signal(c)
+#define cond_bcast(c)    pthread_cond_broadcast(c)
+#endif
+#endif
+
+#endif
@@ -0,0 +1,189 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "img_map.h"
+
+#if IMG_MAP_MMAP
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#endif
+
+#define BMP_HEADER 54
+
+static void
+put32(unsigned char *p, unsigned int v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+#if IMG_MAP_MMAP
+#ifdef _WIN32
+static int
+map_file(struct IMG_MAP *m, char *name, size_t len)
+{
+    HANDLE f, fm;
+    void *base;
+
+    f = CreateFileA(name, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    /* mapping sets the file size */
+    fm = CreateFileMappingA(f, NULL, PAGE_READWRITE,
+            (DWORD) ((unsigned long long) len >> 32), (DWORD) len, NULL);
+    if (fm == NULL) {
+        CloseHandle(f);
+        return 0;
+    }
+    base = MapViewOfFile(fm, FILE_MAP_WRITE, 0, 0, len);
+    if (base == NULL) {
+        CloseHandle(fm);
+        CloseHandle(f);
+        return 0;
+    }
+    m->base = base;
+    m->file = f;
+    m->mapping = fm;
+    return 1;
+}
+
+static int
+unmap_file(struct IMG_MAP *m)
+{
+    int ok;
+
+    ok = FlushViewOfFile(m->base, m->len) != 0;
+    ok = (UnmapViewOfFile(m->base) != 0) && ok;
+    CloseHandle(m->mapping);
+    CloseHandle(m->file);
+    return ok;
+}
+#else
+static int
+map_file(struct IMG_MAP *m, char *name, size_t len)
+{
+    void *base;
+    int fd;
+
+    fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return 0;
+    }
+    /* the new part of the file reads as zeros, a black image */
+    if (ftruncate(fd, (off_t) len) != 0) {
+        close(fd);
+        return 0;
+    }
+    base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+    m->base = base;
+    m->fd = fd;
+    return 1;
+}
+
+static int
+unmap_file(struct IMG_MAP *m)
+{
+    int ok;
+
+    ok = (munmap(m->base, m->len) == 0);
+    ok = (close(m->fd) == 0) && ok;
+    return ok;
+}
+#endif
+#endif
+
+extern unsigned char *
+img_map(struct IMG_MAP *m, char *name, int type, int w, int h)
+{
+#if IMG_MAP_MMAP
+    char ppm[64];
+    unsigned char *p;
+    size_t hdr;
+
+    memset(m, 0, sizeof(*m));
+    if (w <= 0 || h <= 0) {
+        return NULL;
+    }
+    if (type == IMG_MAP_PPM) {
+        hdr = sprintf(ppm, "P6\n%d %d\n255\n", w, h);
+        m->len = hdr + (size_t) w * h * 3;
+    } else {
+        hdr = BMP_HEADER;
+        m->len = hdr + (size_t) w * h * 4;
+    }
+    if (!map_file(m, name, m->len)) {
+        printf("[img_map] unable to map file: %s\n", name);
+        m->base = NULL;
+        return NULL;
+    }
+    p = m->base;
+    if (type == IMG_MAP_PPM) {
+        memcpy(p, ppm, hdr);
+    } else {
+        memset(p, 0, hdr);
+        p[0] = 'B';
+        p[1] = 'M';
+        put32(p + 2, (unsigned int) m->len);
+        put32(p + 10, BMP_HEADER);
+        put32(p + 14, 40);
+        put32(p + 18, w);
+        /* negative height, the rows go from the top down */
+        put32(p + 22, -h);
+        p[26] = 1;
+        p[28] = 32;
+    }
+    return p + hdr;
+#else
+    (void) name;
+    (void) type;
+    (void) w;
+    (void) h;
+    memset(m, 0, sizeof(*m));
+    return NULL;
+#endif
+}
+
+extern int
+img_unmap(struct IMG_MAP *m)
+{
+#if IMG_MAP_MMAP
+    int ok;
+
+    if (m->base == NULL) {
+        return 0;
+    }
+    ok = unmap_file(m);
+    m->base = NULL;
+    return ok;
+#else
+    (void) m;
+    return 0;
+#endif
+}
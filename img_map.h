@@ -0,0 +1,62 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#ifndef _IMG_MAP_
+#define _IMG_MAP_
+
+#include <stddef.h>
+
+/* img_map.h
+ *
+ * Creates an image file of a given size and maps its pixels into memory,
+ * so a CRT can demodulate straight into the file instead of into a buffer
+ * that is written out afterwards. The pixels are laid out top to bottom
+ * without row padding like the CRT's output:
+ *
+ *   IMG_MAP_PPM - 8-bit P6 PPM, pixels are CRT_PIX_FORMAT_RGB
+ *   IMG_MAP_BMP - 32-bit top-down BMP, pixels are CRT_PIX_FORMAT_BGRA
+ *
+ * Uses mmap() or the Win32 file mapping API.
+ *
+ */
+
+/* 0 = no mapping, img_map() always fails */
+#ifndef IMG_MAP_MMAP
+#define IMG_MAP_MMAP 1
+#endif
+
+#define IMG_MAP_PPM 0
+#define IMG_MAP_BMP 1
+
+struct IMG_MAP {
+    void *base; /* start of the mapped file */
+    size_t len; /* file size */
+#ifdef _WIN32
+    void *file, *mapping; /* HANDLEs */
+#else
+    int fd;
+#endif
+};
+
+/* Creates (or truncates) the file and maps it
+ *   type - one of the IMG_MAP_ types
+ *   w, h - image size
+ *
+ * returns the first pixel of the top row, NULL on failure
+ */
+extern unsigned char *img_map(struct IMG_MAP *m, char *name,
+        int type, int w, int h);
+
+/* Writes what is left of the image to the file and unmaps it,
+ * returns 0 on failure
+ */
+extern int img_unmap(struct IMG_MAP *m);
+
+#endif
@@ -11,21 +11,50 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 
 #include "ppm_rw.h"
 
+/* reads the next number of the header, skipping whitespace and comments */
+static int
+header_int(FILE *f, int *val)
+{
+    int c;
+
+    do {
+        c = fgetc(f);
+        if (c == '#') {
+            while (c != EOF && c != '\n') {
+                c = fgetc(f);
+            }
+        }
+    } while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+    if (c < '0' || c > '9') {
+        return 0;
+    }
+    *val = 0;
+    while (c >= '0' && c <= '9') {
+        if (*val > (INT_MAX - 9) / 10) {
+            return 0; /* would overflow */
+        }
+        *val = *val * 10 + (c - '0');
+        c = fgetc(f);
+    }
+    /* c is the single whitespace before the data */
+    return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
 extern int
 ppm_read24(char *file,
            int **out_color, int *out_w, int *out_h,
            void *(*calloc_func)(size_t, size_t))
- {
+{
     FILE *f;
-    long beg;
     int *out;
-    int i, npix;
-    int r, g, b;
-    int header = 0;
-    char buf[64];
+    unsigned char *data = NULL, *p;
+    unsigned char *lut = NULL;
+    int i, npix, bps, r, g, b;
+    size_t len;
     int maxc = 0xff;
 
     f = fopen(file, "rb");
@@ -33,64 +62,75 @@ ppm_read24(char *file,
         printf("[ppm_rw] unable to open ppm: %s\n", file);
         return 0;
     }
-    while (header < 3) {
-        if (!fgets(buf, sizeof(buf), f)) {
-            printf("[ppm_rw] invalid ppm [no data]: %s\n", file);
-            goto err;
-        }
-        if (buf[0] == '#') {
-            continue;
-        }
-        switch (header) {
-            case 0:
-                if (buf[0] != 'P' || buf[1] != '6') {
-                    printf("[ppm_rw] invalid ppm [not P6]: %s\n", file);
-                    goto err;
-                }
-                break;
-            case 1:
-                if (sscanf(buf, "%d %d", out_w, out_h) != 2) {
-                    printf("[ppm_rw] invalid ppm [no dim]: %s\n", file);
-                    goto err;
-                }
-                break;
-            case 2:
-                maxc = atoi(buf);
-                if (maxc > 0xff) {
-                    printf("[ppm_rw] invalid ppm [>255]: %s\n", file);
-                    goto err;
-                }
-                break;
-            default:
-                break;
-        }
-        header++;
+    if (fgetc(f) != 'P' || fgetc(f) != '6') {
+        printf("[ppm_rw] invalid ppm [not P6]: %s\n", file);
+        goto err;
+    }
+    if (!header_int(f, out_w) || !header_int(f, out_h) ||
+            *out_w <= 0 || *out_h <= 0) {
+        printf("[ppm_rw] invalid ppm [no dim]: %s\n", file);
+        goto err;
     }
-           
-    beg = ftell(f);
+    if (!header_int(f, &maxc) || maxc < 1 || maxc > 0xffff) {
+        printf("[ppm_rw] invalid ppm [bad maxval]: %s\n", file);
+        goto err;
+    }
+    /* samples above 255 take two bytes, most significant first */
+    bps = (maxc > 0xff) ? 2 : 1;
+    /* the pixel count and the byte count have to fit */
+    if (*out_w > INT_MAX / *out_h ||
+        (size_t) *out_w * *out_h > ((size_t) -1) / (3 * bps)) {
+        printf("[ppm_rw] invalid ppm [too big]: %s\n", file);
+        goto err;
+    }
+
     npix = *out_w * *out_h;
+    len = (size_t) npix * 3 * bps;
+    data = malloc(len);
+    if (maxc != 0xff) {
+        lut = malloc(maxc + 1);
+    }
+    if (data == NULL || (maxc != 0xff && lut == NULL)) {
+        printf("[ppm_rw] out of memory loading ppm: %s\n", file);
+        goto err;
+    }
+    if (fread(data, 1, len, f) != len) {
+        printf("[ppm_rw] early eof: %s\n", file);
+        goto err;
+    }
     *out_color = calloc_func(npix, sizeof(int));
     if (*out_color == NULL) {
         printf("[ppm_rw] out of memory loading ppm: %s\n", file);
         goto err;
     }
     out = *out_color;
-    /*printf("ppm 24-bit w: %d, h: %d, s: %d\n", *out_w, *out_h, npix);*/
-    for (i = 0; i < npix; i++) {
-#define TO_8_BIT(x) (((x) * 255 + (maxc) / 2) / (maxc))
-        r = TO_8_BIT(fgetc(f));
-        g = TO_8_BIT(fgetc(f));
-        b = TO_8_BIT(fgetc(f));
-        if (feof(f)) {
-            printf("[ppm_rw] early eof: %s\n", file);
-            goto err;
+    p = data;
+    if (maxc == 0xff) {
+        for (i = 0; i < npix; i++) {
+            out[i] = (p[0] << 16 | p[1] << 8 | p[2]);
+            p += 3;
+        }
+    } else {
+        for (i = 0; i <= maxc; i++) {
+            lut[i] = (i * 255 + maxc / 2) / maxc;
+        }
+#define SAMPLE(s, k) ((bps == 1) ? s[k] : (s[2 * (k)] << 8 | s[2 * (k) + 1]))
+#define TO_8_BIT(x) (((x) > maxc) ? 0xff : lut[x])
+        for (i = 0; i < npix; i++) {
+            r = SAMPLE(p, 0);
+            g = SAMPLE(p, 1);
+            b = SAMPLE(p, 2);
+            out[i] = (TO_8_BIT(r) << 16 | TO_8_BIT(g) << 8 | TO_8_BIT(b));
+            p += 3 * bps;
         }
-        out[i] = (r << 16 | g << 8 | b);
     }
-    fseek(f, beg, SEEK_SET);
+    free(lut);
+    free(data);
     fclose(f);
     return 1;
 err:
+    free(lut);
+    free(data);
     fclose(f);
     return 0;
 }
@@ -99,23 +139,40 @@ extern int
 ppm_write24(char *name, int *color, int w, int h)
 {
     FILE *f;
-    int i, npix, c;
+    unsigned char *row, *p;
+    int x, y, c;
 
     f = fopen(name, "wb");
     if (f == NULL) {
         printf("[ppm_rw] failed to write file: %s\n", name);
         return 0;
     }
+    row = malloc(w * 3);
+    if (row == NULL) {
+        printf("[ppm_rw] out of memory writing ppm: %s\n", name);
+        fclose(f);
+        return 0;
+    }
 
     fprintf(f, "P6\n%d %d\n255\n", w, h);
 
-    npix = w * h;
-    for (i = 0; i < npix; i++) {
-        c = *color++;
-        fputc((c >> 16 & 0xff), f);
-        fputc((c >> 8  & 0xff), f);
-        fputc((c >> 0  & 0xff), f);
+    for (y = 0; y < h; y++) {
+        p = row;
+        for (x = 0; x < w; x++) {
+            c = *color++;
+            p[0] = (c >> 16 & 0xff);
+            p[1] = (c >> 8  & 0xff);
+            p[2] = (c >> 0  & 0xff);
+            p += 3;
+        }
+        if (fwrite(row, 3, w, f) != (size_t) w) {
+            printf("[ppm_rw] failed to write file: %s\n", name);
+            free(row);
+            fclose(f);
+            return 0;
+        }
     }
+    free(row);
     fclose(f);
     return 1;
 }
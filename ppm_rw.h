@@ -13,7 +13,9 @@
 
 /* ppm_rw.h
  *
- * Routines to read and write non-ASCII 24-bit PPM images.
+ * Routines to read and write non-ASCII (P6) PPM images. Images with a
+ * maxval other than 255, including 16-bit ones, are scaled to 8 bits
+ * when read, images are always written with 8 bits per sample.
  *
  */
 
@@ -0,0 +1,334 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "video_rw.h"
+
+#define Y4M_MAGIC "YUV4MPEG2 "
+#define Y4M_LINE  1024 /* longest header line that is accepted */
+
+static FILE *
+open_std(char *name, FILE *std, const char *mode)
+{
+    if (strcmp(name, "-") != 0) {
+        return fopen(name, mode);
+    }
+#ifdef _WIN32
+    _setmode(_fileno(std), _O_BINARY);
+#endif
+    return std;
+}
+
+/* reads a header line without the '\n', returns 0 at eof */
+static int
+read_line(FILE *f, char *buf, int n)
+{
+    int c, i = 0;
+
+    while ((c = fgetc(f)) != EOF && c != '\n') {
+        if (i == n - 1) {
+            return 0;
+        }
+        buf[i++] = c;
+    }
+    buf[i] = '\0';
+    return (c == '\n');
+}
+
+/* size of a chroma plane */
+static void
+chroma_size(struct VIDEO *v, int *cw, int *ch)
+{
+    switch (v->chroma) {
+        case VIDEO_C420: *cw = (v->w + 1) / 2; *ch = (v->h + 1) / 2; break;
+        case VIDEO_C422: *cw = (v->w + 1) / 2; *ch = v->h;           break;
+        case VIDEO_C444: *cw = v->w;           *ch = v->h;           break;
+        default:         *cw = 0;              *ch = 0;              break;
+    }
+}
+
+static int
+frame_setup(struct VIDEO *v)
+{
+    int cw, ch;
+
+    if (v->y4m) {
+        chroma_size(v, &cw, &ch);
+        v->len = v->w * v->h + 2 * cw * ch;
+    } else {
+        v->len = v->w * v->h * 3;
+    }
+    v->buf = malloc(v->len);
+    if (v->buf == NULL) {
+        fprintf(stderr, "[video_rw] out of memory\n");
+        return 0;
+    }
+    return 1;
+}
+
+static int
+parse_header(struct VIDEO *v, char *hdr)
+{
+    char *t;
+
+    if (strncmp(hdr, Y4M_MAGIC, strlen(Y4M_MAGIC)) != 0) {
+        fprintf(stderr, "[video_rw] not a y4m video\n");
+        return 0;
+    }
+    v->chroma = VIDEO_C420;
+    v->fps_n = 30000;
+    v->fps_d = 1001;
+    for (t = strtok(hdr + strlen(Y4M_MAGIC), " "); t; t = strtok(NULL, " ")) {
+        switch (t[0]) {
+            case 'W':
+                v->w = atoi(t + 1);
+                break;
+            case 'H':
+                v->h = atoi(t + 1);
+                break;
+            case 'F':
+                if (sscanf(t + 1, "%d:%d", &v->fps_n, &v->fps_d) != 2) {
+                    fprintf(stderr, "[video_rw] bad frame rate %s\n", t);
+                    return 0;
+                }
+                break;
+            case 'C':
+                if (strncmp(t + 1, "420", 3) == 0) {
+                    /* 420, 420jpeg, 420mpeg2, 420paldv, the siting is ignored */
+                    v->chroma = VIDEO_C420;
+                } else if (strcmp(t + 1, "422") == 0) {
+                    v->chroma = VIDEO_C422;
+                } else if (strcmp(t + 1, "444") == 0) {
+                    v->chroma = VIDEO_C444;
+                } else if (strcmp(t + 1, "mono") == 0) {
+                    v->chroma = VIDEO_CMONO;
+                } else {
+                    fprintf(stderr, "[video_rw] unsupported y4m colorspace %s\n", t);
+                    return 0;
+                }
+                break;
+            default:
+                /* interlacing, aspect ratio and extensions don't matter */
+                break;
+        }
+    }
+    if (v->w <= 0 || v->h <= 0) {
+        fprintf(stderr, "[video_rw] y4m without a size\n");
+        return 0;
+    }
+    return 1;
+}
+
+extern int
+video_open_read(struct VIDEO *v, char *name, int w, int h)
+{
+    char hdr[Y4M_LINE];
+
+    memset(v, 0, sizeof(*v));
+    v->fp = open_std(name, stdin, "rb");
+    if (v->fp == NULL) {
+        fprintf(stderr, "[video_rw] unable to open video: %s\n", name);
+        return 0;
+    }
+    if (w > 0 && h > 0) {
+        v->w = w;
+        v->h = h;
+    } else {
+        v->y4m = 1;
+        if (!read_line(v->fp, hdr, sizeof(hdr)) || !parse_header(v, hdr)) {
+            fprintf(stderr, "[video_rw] invalid y4m header: %s\n", name);
+            goto err;
+        }
+    }
+    if (!frame_setup(v)) {
+        goto err;
+    }
+    return 1;
+err:
+    video_close(v);
+    return 0;
+}
+
+extern int
+video_open_write(struct VIDEO *v, char *name, int w, int h,
+        int y4m, int fps_n, int fps_d, int interlaced)
+{
+    memset(v, 0, sizeof(*v));
+    v->fp = open_std(name, stdout, "wb");
+    if (v->fp == NULL) {
+        fprintf(stderr, "[video_rw] failed to write file: %s\n", name);
+        return 0;
+    }
+    v->w = w;
+    v->h = h;
+    v->y4m = y4m;
+    v->chroma = VIDEO_C420;
+    v->fps_n = fps_n;
+    v->fps_d = fps_d;
+    v->interlaced = interlaced;
+    if (!frame_setup(v)) {
+        video_close(v);
+        return 0;
+    }
+    if (y4m) {
+        fprintf(v->fp, Y4M_MAGIC "W%d H%d F%d:%d I%c A1:1 C420jpeg\n",
+                w, h, fps_n, fps_d, interlaced ? 't' : 'p');
+    }
+    return 1;
+}
+
+static int
+clamp8(int x)
+{
+    return (x < 0) ? 0 : (x > 255) ? 255 : x;
+}
+
+extern int
+video_read(struct VIDEO *v, int *color)
+{
+    char line[Y4M_LINE];
+    unsigned char *py, *pu, *pv;
+    int x, y, n, cw, ch, sx, sy;
+    int c, d, e;
+
+    /* the video may only end between frames */
+    c = fgetc(v->fp);
+    if (c == EOF) {
+        if (ferror(v->fp)) {
+            fprintf(stderr, "[video_rw] failed to read frame\n");
+            return -1;
+        }
+        return 0; /* end of the video */
+    }
+    ungetc(c, v->fp);
+    if (v->y4m) {
+        if (!read_line(v->fp, line, sizeof(line)) ||
+            strncmp(line, "FRAME", 5) != 0) {
+            fprintf(stderr, "[video_rw] invalid y4m frame header\n");
+            return -1;
+        }
+    }
+    n = (int) fread(v->buf, 1, v->len, v->fp);
+    if (n != v->len) {
+        if (ferror(v->fp)) {
+            fprintf(stderr, "[video_rw] failed to read frame\n");
+        } else {
+            fprintf(stderr, "[video_rw] early eof\n");
+        }
+        return -1;
+    }
+    if (!v->y4m) {
+        py = v->buf;
+        for (n = 0; n < v->w * v->h; n++) {
+            color[n] = (py[0] << 16 | py[1] << 8 | py[2]);
+            py += 3;
+        }
+        return 1;
+    }
+    chroma_size(v, &cw, &ch);
+    sx = (cw < v->w);
+    sy = (ch < v->h);
+    py = v->buf;
+    pu = v->buf + v->w * v->h;
+    pv = pu + cw * ch;
+    for (y = 0; y < v->h; y++) {
+        for (x = 0; x < v->w; x++) {
+            c = 298 * (*py++ - 16);
+            if (v->chroma == VIDEO_CMONO) {
+                d = 0;
+                e = 0;
+            } else {
+                n = (x >> sx) + (y >> sy) * cw;
+                d = pu[n] - 128;
+                e = pv[n] - 128;
+            }
+            *color++ = clamp8((c + 409 * e + 128) >> 8) << 16
+                     | clamp8((c - 100 * d - 208 * e + 128) >> 8) << 8
+                     | clamp8((c + 516 * d + 128) >> 8);
+        }
+    }
+    return 1;
+}
+
+extern int
+video_write(struct VIDEO *v, int *color)
+{
+    unsigned char *p, *pu, *pv;
+    int x, y, i, j, n, r, g, b;
+    int cw, ch, su, sv, k;
+
+    if (!v->y4m) {
+        p = v->buf;
+        for (n = 0; n < v->w * v->h; n++) {
+            p[0] = color[n] >> 16 & 0xff;
+            p[1] = color[n] >> 8  & 0xff;
+            p[2] = color[n] >> 0  & 0xff;
+            p += 3;
+        }
+    } else {
+        p = v->buf;
+        for (n = 0; n < v->w * v->h; n++) {
+            r = color[n] >> 16 & 0xff;
+            g = color[n] >> 8  & 0xff;
+            b = color[n] >> 0  & 0xff;
+            *p++ = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        }
+        /* chroma is the average of each 2x2 block */
+        chroma_size(v, &cw, &ch);
+        pu = v->buf + v->w * v->h;
+        pv = pu + cw * ch;
+        for (y = 0; y < ch; y++) {
+            for (x = 0; x < cw; x++) {
+                su = sv = k = 0;
+                for (j = y * 2; j < y * 2 + 2 && j < v->h; j++) {
+                    for (i = x * 2; i < x * 2 + 2 && i < v->w; i++) {
+                        n = color[i + j * v->w];
+                        r = n >> 16 & 0xff;
+                        g = n >> 8  & 0xff;
+                        b = n >> 0  & 0xff;
+                        su += -38 * r -  74 * g + 112 * b;
+                        sv += 112 * r -  94 * g -  18 * b;
+                        k++;
+                    }
+                }
+                *pu++ = clamp8(((su / k + 128) >> 8) + 128);
+                *pv++ = clamp8(((sv / k + 128) >> 8) + 128);
+            }
+        }
+        fputs("FRAME\n", v->fp);
+    }
+    if (fwrite(v->buf, 1, v->len, v->fp) != (size_t) v->len) {
+        fprintf(stderr, "[video_rw] failed to write frame\n");
+        return 0;
+    }
+    return 1;
+}
+
+extern void
+video_close(struct VIDEO *v)
+{
+    if (v->fp && v->fp != stdin && v->fp != stdout) {
+        fclose(v->fp);
+    } else if (v->fp == stdout) {
+        fflush(stdout);
+    }
+    free(v->buf);
+    v->fp = NULL;
+    v->buf = NULL;
+}
@@ -0,0 +1,66 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#ifndef _VIDEO_RW_
+#define _VIDEO_RW_
+
+#include <stdio.h>
+
+/* video_rw.h
+ *
+ * Routines to read and write video one frame at a time, as raw 24-bit RGB
+ * or YUV4MPEG2 (y4m, 8-bit 4:2:0, 4:2:2, 4:4:4 or mono). Frames are
+ * 0xRRGGBB ints like ppm_rw. YUV is BT.601 with the 16-235 range.
+ * Messages go to stderr since the video itself can be on stdout.
+ *
+ */
+
+#define VIDEO_C420  0
+#define VIDEO_C422  1
+#define VIDEO_C444  2
+#define VIDEO_CMONO 3
+
+struct VIDEO {
+    FILE *fp;
+    int w, h;
+    int y4m; /* 0 = raw RGB */
+    int chroma; /* one of the VIDEO_Cs, y4m only */
+    int fps_n, fps_d; /* frame rate, y4m only */
+    int interlaced; /* 1 = top field first, 0 = progressive, y4m only */
+    unsigned char *buf; /* one frame as it is stored */
+    int len; /* bytes per frame */
+};
+
+/* Opens a video for reading
+ *   name - file name, "-" is stdin
+ *   w, h - size of a raw RGB video, 0 to read a y4m header instead
+ */
+extern int video_open_read(struct VIDEO *v, char *name, int w, int h);
+
+/* Opens a video for writing, y4m is written as 4:2:0
+ *   name         - file name, "-" is stdout
+ *   y4m          - 1 = y4m, 0 = raw RGB
+ *   fps_n, fps_d - frame rate for the y4m header
+ *   interlaced   - 1 = frames are two fields, top field first,
+ *                  0 = progressive, for the y4m header
+ */
+extern int video_open_write(struct VIDEO *v, char *name, int w, int h,
+        int y4m, int fps_n, int fps_d, int interlaced);
+
+/* returns 1 if a frame was read, 0 at the end of the video,
+ *        -1 on error (a read error, a cut off frame or a bad frame header)
+ */
+extern int video_read(struct VIDEO *v, int *color);
+
+extern int video_write(struct VIDEO *v, int *color);
+
+extern void video_close(struct VIDEO *v);
+
+#endif